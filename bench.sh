@@ -0,0 +1,149 @@
+#!/bin/bash
+# Measures elapsed time of preprocessing, training and translation on
+# synthetic corpora of several scales, and compares it with the baseline.
+#
+# Usage: ./bench.sh [--update-baseline]
+# Settings can be overridden by environment variables, e.g.,
+#   $ SCALES="10000:4000 100000:16000" STEPS=50 GPUID=0 ./bench.sh
+
+BIN=${BIN:-./build/primitiv_nmt}
+WORK=${WORK:-./bench}
+BASELINE=${BASELINE:-${WORK}/baseline.tsv}
+RESULTS=${WORK}/results.tsv
+
+# Space-separated <#train sentences>:<#distinct words> of each scale.
+SCALES=${SCALES:-"10000:4000 100000:16000 1000000:32000"}
+STEPS=${STEPS:-100}  # Approximate number of training steps.
+EMBED=${EMBED:-256}
+HIDDEN=${HIDDEN:-256}
+BATCH=${BATCH:-64}
+LEARNING_RATE=0.0001
+TOLERANCE=${TOLERANCE:-0.1}  # Allowed slowdown against the baseline.
+GPUID=${GPUID:-}  # Required by CUDA builds.
+HOGWILD_WORKERS=${HOGWILD_WORKERS:-4}  # Compared with a single worker.
+HOGWILD_EPOCHS=${HOGWILD_EPOCHS:-3}
+
+set -e -o pipefail
+mkdir -p ${WORK}
+: > ${RESULTS}
+
+# Runs the command and records its elapsed time in seconds.
+measure() {
+  local name=$1
+  shift
+  local start=$(date +%s.%N)
+  if ! "$@" > ${DIR}/${name}.log 2>&1; then
+    echo "Failed: ${name} (see ${DIR}/${name}.log)"
+    exit 1
+  fi
+  local end=$(date +%s.%N)
+  local secs=$(echo "${start} ${end}" | awk '{printf "%.3f", $2 - $1}')
+  printf "%s\t%s\t%s\n" ${SCALE} ${name} ${secs} | tee -a ${RESULTS}
+}
+
+for SCALE in ${SCALES}; do
+  SENTS=${SCALE%:*}
+  WORDS=${SCALE#*:}
+  DIR=${WORK}/${SCALE/:/_}
+  rm -rf ${DIR}
+  mkdir -p ${DIR}
+
+  measure generate ${BIN}/make_synthetic ${SENTS} ${WORDS} \
+    ${DIR}/train.{src,trg} --seed 1
+  ${BIN}/make_synthetic 1000 ${WORDS} ${DIR}/dev.{src,trg} --seed 2 > /dev/null
+  ${BIN}/make_synthetic 200 ${WORDS} ${DIR}/test.{src,trg} --seed 3 > /dev/null
+
+  measure make_vocab.src ${BIN}/make_vocab ${WORDS} \
+    ${DIR}/train.src ${DIR}/vocab.src
+  measure make_vocab.trg ${BIN}/make_vocab ${WORDS} \
+    ${DIR}/train.trg ${DIR}/vocab.trg
+  measure make_corpus ${BIN}/make_corpus 1 80 \
+    ${DIR}/train.{src,trg} ${DIR}/vocab.{src,trg} ${DIR}/corpus.train
+
+  # Trains one epoch on the first STEPS * BATCH sentences. The number of
+  # steps is slightly larger because batches hold sentences of equal lengths.
+  for l in src trg; do
+    head -n $((STEPS * BATCH)) ${DIR}/train.${l} > ${DIR}/steps.${l}
+  done
+  ${BIN}/make_corpus 1 80 \
+    ${DIR}/steps.{src,trg} ${DIR}/vocab.{src,trg} ${DIR}/corpus.steps \
+    > /dev/null
+  ${BIN}/make_corpus 1 80 \
+    ${DIR}/dev.{src,trg} ${DIR}/vocab.{src,trg} ${DIR}/corpus.dev > /dev/null
+  measure train ${BIN}/train \
+    ${DIR}/corpus.{steps,dev} ${DIR}/vocab.{src,trg} ${DIR}/model \
+    ${EMBED} ${HIDDEN} ${BATCH} ${LEARNING_RATE} 1 ${GPUID}
+
+  measure translate ${BIN}/translate \
+    ${DIR}/vocab.{src,trg} ${DIR}/model 1 ${GPUID} < ${DIR}/test.src
+done
+
+# Convergence and throughput of hogwild training against a single worker on
+# the first scale. Records elapsed seconds, sentences/sec and losses after
+# each epoch. Informative only, not compared with the baseline.
+if [ -z "${GPUID}" ]; then
+  FIRST=${SCALES%% *}
+  DIR=${WORK}/${FIRST/:/_}
+  SENTS=$(wc -l < ${DIR}/steps.src)
+  printf "mode\tepoch\tseconds\tsents/sec\ttrain loss\tdev loss\n" \
+    > ${WORK}/hogwild.tsv
+  W=${HOGWILD_WORKERS}
+  for MODE in "workers=1:--workers 1" "hogwild=${W}:--workers ${W} --hogwild 1"
+  do
+    NAME=${MODE%%:*}
+    rm -rf ${DIR}/model.${NAME}
+    start=$(date +%s.%N)
+    ${BIN}/train ${DIR}/corpus.{steps,dev} ${DIR}/vocab.{src,trg} \
+      ${DIR}/model.${NAME} ${EMBED} ${HIDDEN} ${BATCH} ${LEARNING_RATE} \
+      ${HOGWILD_EPOCHS} ${MODE#*:} 2>&1 \
+      | tr '\r' '\n' \
+      | while IFS= read -r line; do echo "$(date +%s.%N) ${line}"; done \
+      > ${DIR}/train.${NAME}.log
+    awk -v name=${NAME} -v start=${start} -v sents=${SENTS} '
+      / Train loss: / { epoch++; secs = $1 - start; train = $NF }
+      / Dev loss: / {
+        printf "%s\t%d\t%.1f\t%.1f\t%s\t%s\n",
+               name, epoch, secs, epoch * sents / secs, train, $NF
+      }
+    ' ${DIR}/train.${NAME}.log >> ${WORK}/hogwild.tsv
+  done
+  echo "Hogwild: see ${WORK}/hogwild.tsv"
+fi
+
+# Decoding time of global and local attention on random inputs.
+# Informative only, not compared with the baseline.
+${BIN}/bench_attention 200 200 ${HIDDEN} 10 ${GPUID} --windows 0,5,10 \
+  > ${WORK}/attention.txt
+echo "Attention: see ${WORK}/attention.txt"
+
+# Crossover sparsity of the sparse kernel on a decoder LSTM weight during
+# translation. Informative only, not compared with the baseline.
+${BIN}/bench_sparse $((4 * HIDDEN)) $((HIDDEN + EMBED)) 1 100 ${GPUID} \
+  --block 4x4 > ${WORK}/sparse.txt
+echo "Sparse kernel: $(tail -n 1 ${WORK}/sparse.txt) (see ${WORK}/sparse.txt)"
+
+if [ "$1" == "--update-baseline" ]; then
+  cp ${RESULTS} ${BASELINE}
+  echo "Updated ${BASELINE}."
+  exit 0
+fi
+if [ ! -e ${BASELINE} ]; then
+  echo "No baseline: ${BASELINE} (run with --update-baseline to make it)"
+  exit 0
+fi
+
+# Compares with the baseline, and fails if anything is slower than allowed.
+echo
+awk -F '\t' -v tol=${TOLERANCE} '
+  NR == FNR { base[$1 "\t" $2] = $3; next }
+  {
+    key = $1 "\t" $2
+    if (!(key in base)) { printf "%s\t%s\t(no baseline)\n", key, $3; next }
+    ratio = $3 / (base[key] > 0 ? base[key] : 1e-3)
+    slow = ratio > 1 + tol
+    printf "%s\t%s -> %s sec\t%.2fx%s\n", key, base[key], $3, ratio,
+           slow ? "\tREGRESSION" : ""
+    if (slow) failed = 1
+  }
+  END { exit failed }
+' ${BASELINE} ${RESULTS}
@@ -0,0 +1,209 @@
+#ifndef PRIMITIV_NMT_ADAPTIVE_SOFTMAX_H_
+#define PRIMITIV_NMT_ADAPTIVE_SOFTMAX_H_
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <primitiv/primitiv.h>
+
+#include <primitiv_nmt/affine.h>
+
+// Adaptive softmax (Grave et al., 2017).
+// Word IDs should be sorted by frequency. Words in [0, c_0) belong to the
+// head cluster, and words in [c_{k-1}, c_k) belong to the k-th tail cluster,
+// where c_k are cutoffs and the last boundary is the vocabulary size.
+// The head cluster also predicts one token for each tail cluster, and each
+// tail cluster uses a smaller projection of the input:
+//   p(w) = p_head(w)                        if w is in the head,
+//   p(w) = p_head(k) * p_k(w | proj_k(x))  if w is in the k-th tail.
+template<typename Var>
+class AdaptiveSoftmax : public primitiv::Model {
+  ::Affine<Var> head_;
+  std::vector<std::unique_ptr<primitiv::Parameter>> pprojs_;
+  std::vector<std::unique_ptr<::Affine<Var>>> tails_;
+  std::vector<Var> projs_;
+
+  AdaptiveSoftmax(const AdaptiveSoftmax &) = delete;
+  AdaptiveSoftmax &operator=(const AdaptiveSoftmax &) = delete;
+
+  // Calculates log probabilities of words in the k-th tail cluster.
+  Var tail_log_probs(unsigned k, const Var &x) {
+    namespace F = primitiv::functions;
+    return F::log_softmax(tails_[k]->forward(F::matmul(projs_[k], x)), 0);
+  }
+
+public:
+  // New object with given number of tail clusters.
+  explicit AdaptiveSoftmax(unsigned num_tails) {
+    add("head", head_);
+    for (unsigned k = 0; k < num_tails; ++k) {
+      pprojs_.emplace_back(new primitiv::Parameter());
+      tails_.emplace_back(new ::Affine<Var>());
+      add("proj" + std::to_string(k), *pprojs_.back());
+      add("tail" + std::to_string(k), *tails_.back());
+    }
+  }
+
+  // Initializes parameters. `cutoffs` should be increasing and smaller than
+  // `output_size`. The projection size of the k-th tail is
+  // input_size / 4^(k + 1).
+  void init(
+      unsigned input_size, unsigned output_size,
+      const std::vector<unsigned> &cutoffs) {
+    namespace I = primitiv::initializers;
+    if (cutoffs.empty() || cutoffs.size() != tails_.size()) {
+      throw std::runtime_error(
+          "Number of adaptive softmax cutoffs mismatched.");
+    }
+    for (unsigned k = 0; k < cutoffs.size(); ++k) {
+      if (cutoffs[k] == 0 || cutoffs[k] >= output_size
+          || (k > 0 && cutoffs[k] <= cutoffs[k - 1])) {
+        throw std::runtime_error(
+            "Invalid adaptive softmax cutoffs for vocabulary size "
+            + std::to_string(output_size));
+      }
+    }
+    head_.init(input_size, cutoffs[0] + tails_.size());
+    for (unsigned k = 0; k < tails_.size(); ++k) {
+      const unsigned proj_size = std::max(1u, input_size >> (2 * (k + 1)));
+      const unsigned last =
+        k + 1 < cutoffs.size() ? cutoffs[k + 1] : output_size;
+      pprojs_[k]->init({proj_size, input_size}, I::Uniform(-0.1, 0.1));
+      tails_[k]->init(proj_size, last - cutoffs[k]);
+    }
+  }
+
+  // Initializes internal values.
+  void reset() {
+    namespace F = primitiv::functions;
+    head_.reset();
+    projs_.clear();
+    for (unsigned k = 0; k < tails_.size(); ++k) {
+      projs_.emplace_back(F::parameter<Var>(*pprojs_[k]));
+      tails_[k]->reset();
+    }
+  }
+
+  // Calculates log probabilities of all words.
+  Var log_probs(const Var &x) {
+    namespace F = primitiv::functions;
+    const unsigned head_words = head_size();
+    const Var head_lp = F::log_softmax(head_.forward(x), 0);
+    std::vector<Var> lps { F::slice(head_lp, 0, 0, head_words) };
+    for (unsigned k = 0; k < tails_.size(); ++k) {
+      const Var cluster_lp = F::slice(
+          head_lp, 0, head_words + k, head_words + k + 1);
+      lps.emplace_back(
+          F::broadcast(cluster_lp, 0, tails_[k]->output_size())
+          + tail_log_probs(k, x));
+    }
+    return F::concat(lps, 0);
+  }
+
+  // Calculates negative log likelihoods of `ids` for each batch.
+  // Tail clusters without any of `ids` are not calculated.
+  Var loss(const Var &x, const std::vector<unsigned> &ids) {
+    namespace F = primitiv::functions;
+    const unsigned batch_size = ids.size();
+    const unsigned head_words = head_size();
+    primitiv::Device &dev = x.device();
+
+    std::vector<unsigned> head_ids(ids);
+    for (unsigned b = 0; b < batch_size; ++b) {
+      if (ids[b] >= head_words) head_ids[b] = head_words + cluster(ids[b]);
+    }
+    const Var head_lp = F::log_softmax(head_.forward(x), 0);
+    Var nll = -F::pick(head_lp, head_ids, 0);
+
+    unsigned first = head_words;
+    for (unsigned k = 0; k < tails_.size(); ++k) {
+      const unsigned last = first + tails_[k]->output_size();
+      std::vector<unsigned> tail_ids(batch_size, 0);
+      std::vector<float> mask(batch_size, 0);
+      bool used = false;
+      for (unsigned b = 0; b < batch_size; ++b) {
+        if (ids[b] >= first && ids[b] < last) {
+          tail_ids[b] = ids[b] - first;
+          mask[b] = 1;
+          used = true;
+        }
+      }
+      if (used) {
+        nll = nll - F::pick(tail_log_probs(k, x), tail_ids, 0)
+          * F::input<Var>(primitiv::Shape({1}, batch_size), mask, dev);
+      }
+      first = last;
+    }
+    return nll;
+  }
+
+  // Returns the most probable word of each batch.
+  // A tail cluster is calculated only if its probability exceeds the best
+  // probability of words found so far. Only the best words and probabilities
+  // of each cluster are copied from the device.
+  std::vector<unsigned> argmax(const Var &x) {
+    namespace F = primitiv::functions;
+    const unsigned head_words = head_size();
+    const unsigned num_tails = tails_.size();
+    const Var head_lp = F::log_softmax(head_.forward(x), 0);
+    std::vector<unsigned> best_ids =
+      F::slice(head_lp, 0, 0, head_words).argmax(0);
+    const unsigned batch_size = best_ids.size();
+
+    // Best log probabilities followed by ones of tail clusters.
+    const std::vector<float> lps = F::concat({
+        F::pick(head_lp, best_ids, 0),
+        F::slice(head_lp, 0, head_words, head_words + num_tails)}, 0)
+      .to_vector();
+    std::vector<float> best_lps(batch_size);
+    for (unsigned b = 0; b < batch_size; ++b) {
+      best_lps[b] = lps[b * (num_tails + 1)];
+    }
+
+    unsigned first = head_words;
+    for (unsigned k = 0; k < num_tails; ++k) {
+      bool needed = false;
+      for (unsigned b = 0; b < batch_size; ++b) {
+        if (lps[b * (num_tails + 1) + k + 1] > best_lps[b]) {
+          needed = true;
+          break;
+        }
+      }
+      if (needed) {
+        const Var tail_lp = tail_log_probs(k, x);
+        const std::vector<unsigned> ids = tail_lp.argmax(0);
+        const std::vector<float> tail_best =
+          F::pick(tail_lp, ids, 0).to_vector();
+        for (unsigned b = 0; b < batch_size; ++b) {
+          const float lp = lps[b * (num_tails + 1) + k + 1] + tail_best[b];
+          if (lp > best_lps[b]) {
+            best_ids[b] = first + ids[b];
+            best_lps[b] = lp;
+          }
+        }
+      }
+      first += tails_[k]->output_size();
+    }
+    return best_ids;
+  }
+
+  // Returns the tail cluster of the word, which should not be in the head.
+  unsigned cluster(unsigned id) const {
+    unsigned first = head_size();
+    for (unsigned k = 0; k < tails_.size(); ++k) {
+      first += tails_[k]->output_size();
+      if (id < first) return k;
+    }
+    throw std::runtime_error("Word ID out of range: " + std::to_string(id));
+  }
+
+  // Retrieves hyperparameters.
+  unsigned input_size() const { return head_.input_size(); }
+  unsigned head_size() const { return head_.output_size() - tails_.size(); }
+  unsigned num_tails() const { return tails_.size(); }
+};
+
+#endif  // PRIMITIV_NMT_ADAPTIVE_SOFTMAX_H_
@@ -2,10 +2,13 @@
 #define PRIMITIV_NMT_AFFINE_H_
 
 #include <fstream>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include <primitiv/primitiv.h>
 
+#include <primitiv_nmt/sparse.h>
 #include <primitiv_nmt/utils.h>
 
 // Affine transform
@@ -13,10 +16,13 @@ template<typename Var>
 class Affine : public primitiv::Model {
   primitiv::Parameter pw_, pb_;
   Var w_, b_;
+  bool transposed_;
+  std::shared_ptr<::BlockSparseMatrix> sw_;
+  bool use_sparse_;
 
 public:
   // New model.
-  Affine() {
+  Affine() : transposed_(false), use_sparse_(false) {
     add("w", pw_);
     add("b", pb_);
   }
@@ -33,11 +39,69 @@ public:
     namespace F = primitiv::functions;
     w_ = F::parameter<Var>(pw_);
     b_ = F::parameter<Var>(pb_);
+    transposed_ = false;
+    use_sparse_ = true;
+  }
+
+  // Initializes internal values by external variables instead of own
+  // parameters. If `transposed` is true, `w` is {input_size, output_size},
+  // e.g., an embedding matrix tied with this layer.
+  void reset(const Var &w, const Var &b, bool transposed) {
+    w_ = w;
+    b_ = b;
+    transposed_ = transposed;
+    use_sparse_ = false;
+  }
+
+  // Makes the weight and the bias of the rows in `ids`, which should be
+  // sorted. Should be called after reset(). Contiguous rows are sliced
+  // together.
+  void select_rows(const std::vector<unsigned> &ids, Var &w, Var &b) const {
+    namespace F = primitiv::functions;
+    std::vector<Var> ws, bs;
+    unsigned first = 0;
+    const unsigned dim = transposed_ ? 1 : 0;
+    while (first < ids.size()) {
+      unsigned last = first + 1;
+      while (last < ids.size() && ids[last] == ids[last - 1] + 1) ++last;
+      ws.emplace_back(F::slice(w_, dim, ids[first], ids[last - 1] + 1));
+      bs.emplace_back(F::slice(b_, 0, ids[first], ids[last - 1] + 1));
+      first = last;
+    }
+    w = transposed_ ? F::transpose(F::concat(ws, 1)) : F::concat(ws, 0);
+    b = F::concat(bs, 0);
+  }
+
+  // Restricts outputs to the rows in `ids`, which should be sorted.
+  void restrict_rows(const std::vector<unsigned> &ids) {
+    Var w, b;
+    select_rows(ids, w, b);
+    w_ = w;
+    b_ = b;
+    transposed_ = false;
+    use_sparse_ = false;
+  }
+
+  // Uses a sparse copy of the weight in forward() if at least `min_sparsity`
+  // of its blocks are zero. Only for inference.
+  void make_sparse(
+      float min_sparsity, unsigned block_rows, unsigned block_cols) {
+    sw_ = ::make_sparse_matrix(pw_, min_sparsity, block_rows, block_cols);
   }
 
   // Applies transformation.
   Var forward(const Var &x) {
-    return primitiv::functions::matmul(w_, x) + b_;
+    namespace F = primitiv::functions;
+    if (transposed_) return F::transpose(F::matmul(F::transpose(x), w_)) + b_;
+    return ::sparse_matmul(w_, use_sparse_ ? sw_.get() : nullptr, x) + b_;
+  }
+
+  // Calculates only the ids[i]-th output for the i-th batch.
+  Var forward_picked(const Var &x, const std::vector<unsigned> &ids) const {
+    namespace F = primitiv::functions;
+    const Var w = transposed_
+      ? F::transpose(F::pick(w_, ids, 1)) : F::pick(w_, ids, 0);
+    return F::matmul(w, x) + F::pick(b_, ids, 0);
   }
 
   // Retrieves hyperparameters.
@@ -1,23 +1,32 @@
 #ifndef PRIMITIV_NMT_ATTENTION_H_
 #define PRIMITIV_NMT_ATTENTION_H_
 
+#include <algorithm>
 #include <fstream>
+#include <memory>
 #include <string>
 #include <vector>
 
 #include <primitiv/primitiv.h>
 
+#include <primitiv_nmt/sparse.h>
 #include <primitiv_nmt/utils.h>
 
-// Multilayer perceptron-based attention
+// Multilayer perceptron-based attention.
+// If the window size D is set, the t-th decoding step scores only source
+// positions [t - D, t + D] (local-m attention, Luong et al., 2015), clipped
+// to the source length.
 template<typename Var>
 class Attention : public primitiv::Model {
   primitiv::Parameter pweh_, pwdh_, pbh_, pwha_;
   Var e_mat_, eh_mat_, wdh_, bh_, wha_;
+  std::shared_ptr<::BlockSparseMatrix> sweh_, swdh_;
+  unsigned window_;
+  unsigned step_, lower_, upper_;
 
 public:
   // New object.
-  Attention() {
+  Attention() : window_(0), step_(0), lower_(0), upper_(0) {
     add("weh", pweh_);
     add("wdh", pwdh_);
     add("bh", pbh_);
@@ -39,31 +48,84 @@ public:
     namespace F = primitiv::functions;
     const Var weh = F::parameter<Var>(pweh_);
     e_mat_ = F::concat(enc_states, 1);  // {enc_size, len}
-    eh_mat_ = F::matmul(weh, e_mat_);  // {h_size, len}
+    eh_mat_ = ::sparse_matmul(weh, sweh_.get(), e_mat_);  // {h_size, len}
     wdh_ = F::parameter<Var>(pwdh_);
     bh_ = F::parameter<Var>(pbh_);
     wha_ = F::parameter<Var>(pwha_);
+    step_ = lower_ = upper_ = 0;
   }
 
-  // Calculates attention probabilities.
+  // Calculates attention probabilities of the next decoding step.
+  // Positions out of the window have zero probabilities.
   Var get_probs(const Var &dec_state) {
     namespace F = primitiv::functions;
-    const Var dh = F::matmul(wdh_, dec_state) + bh_;  // {h_size}
-    const Var dh_bc = F::broadcast(dh, 1, eh_mat_.shape()[1]);  // {h_size, len}
-    const Var h = F::tanh(eh_mat_ + dh_bc);
-    const Var a = F::transpose(F::matmul(wha_, h));  // {len}
-    return F::softmax(a, 0);
+    const unsigned len = eh_mat_.shape()[1];
+    if (window_ == 0) {
+      lower_ = 0;
+      upper_ = len;
+    } else {
+      const unsigned center = std::min(step_, len - 1);
+      lower_ = center > window_ ? center - window_ : 0;
+      upper_ = std::min(center + window_ + 1, len);
+    }
+    ++step_;
+
+    const Var eh = upper_ - lower_ == len
+      ? eh_mat_ : F::slice(eh_mat_, 1, lower_, upper_);
+    const Var dh =
+      ::sparse_matmul(wdh_, swdh_.get(), dec_state) + bh_;  // {h_size}
+    const Var dh_bc = F::broadcast(dh, 1, upper_ - lower_);  // {h_size, w}
+    const Var h = F::tanh(eh + dh_bc);
+    const Var a = F::transpose(F::matmul(wha_, h));  // {w}
+    const Var p = F::softmax(a, 0);
+    if (upper_ - lower_ == len) return p;
+
+    const unsigned batch_size = p.shape().batch();
+    std::vector<Var> ps;
+    if (lower_ > 0) {
+      ps.emplace_back(F::zeros<Var>(
+            primitiv::Shape({lower_}, batch_size), bh_.device()));
+    }
+    ps.emplace_back(p);
+    if (upper_ < len) {
+      ps.emplace_back(F::zeros<Var>(
+            primitiv::Shape({len - upper_}, batch_size), bh_.device()));
+    }
+    return F::concat(ps, 0);
   }
 
-  // Calculates a context vector.
+  // Calculates a context vector from the latest attention probabilities.
+  // Only positions in the window are used.
   Var get_context(const Var &att_probs) {
-    return primitiv::functions::matmul(e_mat_, att_probs);
+    namespace F = primitiv::functions;
+    if (upper_ - lower_ == e_mat_.shape()[1]) {
+      return F::matmul(e_mat_, att_probs);
+    }
+    return F::matmul(
+        F::slice(e_mat_, 1, lower_, upper_),
+        F::slice(att_probs, 0, lower_, upper_));
   }
 
+  // Uses sparse copies of weight matrices whose blocks are zero at least
+  // `min_sparsity`. Only for inference.
+  void make_sparse(
+      float min_sparsity, unsigned block_rows, unsigned block_cols) {
+    sweh_ = ::make_sparse_matrix(pweh_, min_sparsity, block_rows, block_cols);
+    swdh_ = ::make_sparse_matrix(pwdh_, min_sparsity, block_rows, block_cols);
+  }
+
+  // Sets the index of the next decoding step, e.g., to restart decoding from
+  // the middle of the sentence.
+  void set_step(unsigned step) { step_ = step; }
+
+  // Sets the window size of local attention. 0 means global attention.
+  void set_window(unsigned window) { window_ = window; }
+
   // Retrieves hyperparameters
   unsigned encoder_size() const { return pweh_.shape()[1]; }
   unsigned decoder_size() const { return pwdh_.shape()[1]; }
   unsigned hidden_size() const { return pweh_.shape()[0]; }
+  unsigned window() const { return window_; }
 };
 
 #endif  // PRIMITIV_NMT_ATTENTION_H_
@@ -0,0 +1,380 @@
+#include <primitiv_nmt/config.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <primitiv/primitiv.h>
+
+#include <primitiv_nmt/cpu_affinity.h>
+#include <primitiv_nmt/data_parallel.h>
+#include <primitiv_nmt/encoder_decoder.h>
+#include <primitiv_nmt/primitiv_nmt.pb.h>
+#include <primitiv_nmt/utils.h>
+
+using namespace std;
+
+// Settings shared by all trials.
+struct TuneSetup {
+  primitiv_nmt::proto::ModelConfig config;
+  unsigned src_vocab_size, trg_vocab_size, embed_size, hidden_size;
+  unsigned length, num_steps, gpu_id;
+};
+
+// One configuration to be measured.
+// task is "train" (training steps), "translate" (greedy decoding of single
+// sentences) or "score" (forced decoding of batches).
+// intra_threads is the number of threads of each tensor operation
+// (0: default of the OpenMP runtime).
+struct Trial {
+  string task;
+  unsigned num_threads, intra_threads, batch_size;
+  bool src_tables, trg_tables;
+};
+
+struct TrialResult {
+  bool ok;
+  double tokens_per_sec;
+  double peak_mb;
+};
+
+// Makes a batch of random words. All sentences have length + 2 words
+// including <bos> and <eos>.
+Batch make_random_batch(
+    const TuneSetup &s, unsigned batch_size, mt19937 &rng) {
+  uniform_int_distribution<unsigned> src_dist(0, s.src_vocab_size - 1);
+  uniform_int_distribution<unsigned> trg_dist(0, s.trg_vocab_size - 1);
+  Batch batch {
+    vector<vector<unsigned>>(s.length + 2, vector<unsigned>(batch_size)),
+    vector<vector<unsigned>>(s.length + 2, vector<unsigned>(batch_size)),
+  };
+  for (auto &words : batch.source) for (auto &w : words) w = src_dist(rng);
+  for (auto &words : batch.target) for (auto &w : words) w = trg_dist(rng);
+  return batch;
+}
+
+unique_ptr<primitiv::Device> make_device(const TuneSetup &s) {
+#ifdef PRIMITIV_NMT_USE_CUDA
+  return unique_ptr<primitiv::Device>(new primitiv::devices::CUDA(s.gpu_id));
+#else
+  static_cast<void>(s);
+  return unique_ptr<primitiv::Device>(new primitiv::devices::Eigen());
+#endif
+}
+
+// Runs the trial and returns processed source and target tokens per second.
+// The first step is not timed.
+double run_trial(const TuneSetup &s, const Trial &t) {
+  ::set_intra_op_threads(t.intra_threads);
+  mt19937 rng(0);
+  const Batch batch = make_random_batch(s, t.batch_size, rng);
+  const double tokens_per_step = 2. * (s.length + 2) * t.batch_size;
+  unique_ptr<primitiv::Device> dev = ::make_device(s);
+  primitiv::Device::set_default(*dev);
+  function<void()> step;
+
+  // Objects used by the step function.
+  unique_ptr<::EncoderDecoder<primitiv::Node>> train_model;
+  unique_ptr<primitiv::optimizers::Adam> opt;
+  unique_ptr<::ReplicaSet> replicas;
+  vector<unique_ptr<primitiv::Device>> devs;
+  vector<unique_ptr<::EncoderDecoder<primitiv::Tensor>>> models;
+
+  if (t.task == "train") {
+    train_model.reset(new ::EncoderDecoder<primitiv::Node>(s.config));
+    train_model->init(
+        s.src_vocab_size, s.trg_vocab_size, s.embed_size, s.hidden_size);
+    opt.reset(new primitiv::optimizers::Adam());
+    opt->set_weight_decay(1e-6);
+    opt->set_gradient_clipping(5);
+    opt->add(*train_model);
+    replicas.reset(new ::ReplicaSet(*train_model, *dev, t.num_threads));
+    step = [&]() {
+      replicas->forward_backward(batch);
+      opt->update();
+      replicas->broadcast();
+    };
+  } else {
+    for (unsigned i = 0; i < t.num_threads; ++i) {
+      if (i > 0) devs.emplace_back(::make_device(s));
+      primitiv::Device::set_default(i > 0 ? *devs.back() : *dev);
+      models.emplace_back(new ::EncoderDecoder<primitiv::Tensor>(s.config));
+      models.back()->init(
+          s.src_vocab_size, s.trg_vocab_size, s.embed_size, s.hidden_size);
+      models.back()->precompute_tables(t.src_tables, t.trg_tables);
+    }
+    primitiv::Device::set_default(*dev);
+    if (t.task == "translate") {
+      step = [&]() {
+        ::EncoderDecoder<primitiv::Tensor> &model = *models[0];
+        model.encode(batch.source);
+        model.init_decoder();
+        vector<unsigned> prev = batch.target[0];
+        for (unsigned i = 0; i <= s.length; ++i) {
+          prev = model.decode_greedy(model.decode_atten(prev));
+        }
+      };
+    } else {
+      step = [&]() {
+        ::parallel_for(models.size(), [&](unsigned i) {
+            models[i]->encode(batch.source);
+            models[i]->init_decoder();
+            models[i]->token_losses(batch.target).to_vector();
+        });
+      };
+    }
+  }
+
+  step();
+  const auto start = chrono::steady_clock::now();
+  for (unsigned i = 0; i < s.num_steps; ++i) step();
+  const auto end = chrono::steady_clock::now();
+  const double secs = chrono::duration<double>(end - start).count();
+  const unsigned num_models = t.task == "score" ? t.num_threads : 1;
+  return tokens_per_step * num_models * s.num_steps / secs;
+}
+
+// Runs the trial in a child process so that its peak memory is measured
+// separately, and a failure (e.g., out of memory) does not stop tuning.
+// Devices are never initialized in the parent process.
+TrialResult run_trial_process(const TuneSetup &s, const Trial &t) {
+  int fds[2];
+  if (::pipe(fds) != 0) throw runtime_error("Could not create a pipe.");
+  cout << flush;
+  const ::pid_t pid = ::fork();
+  if (pid < 0) throw runtime_error("Could not fork a process.");
+  if (pid == 0) {
+    ::close(fds[0]);
+    int status = 1;
+    try {
+      const double value = ::run_trial(s, t);
+      if (::write(fds[1], &value, sizeof(value))
+          == static_cast<::ssize_t>(sizeof(value))) {
+        status = 0;
+      }
+    } catch (exception &ex) {
+      cerr << "Trial failed: " << ex.what() << endl;
+    } catch (...) {
+      cerr << "Trial failed." << endl;
+    }
+    ::_exit(status);
+  }
+
+  ::close(fds[1]);
+  TrialResult ret { false, 0, 0 };
+  const bool received = ::read(
+      fds[0], &ret.tokens_per_sec, sizeof(ret.tokens_per_sec))
+    == static_cast<::ssize_t>(sizeof(ret.tokens_per_sec));
+  ::close(fds[0]);
+  int status;
+  ::rusage usage;
+  if (::wait4(pid, &status, 0, &usage) != pid) {
+    throw runtime_error("Could not wait for the trial process.");
+  }
+  ret.ok = received && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  ret.peak_mb = usage.ru_maxrss / 1024.;  // ru_maxrss is in KB on Linux.
+  return ret;
+}
+
+// Runs all trials and returns the index of the fastest one within the
+// memory limit, or -1 if no trial succeeded.
+int find_best(
+    const TuneSetup &s, const vector<Trial> &trials, double memory_limit) {
+  int best = -1;
+  double best_speed = 0;
+  for (unsigned i = 0; i < trials.size(); ++i) {
+    const Trial &t = trials[i];
+    cout << t.task << ": threads=" << t.num_threads
+         << " intra-threads=" << t.intra_threads
+         << " batch=" << t.batch_size
+         << " src-tables=" << t.src_tables
+         << " trg-tables=" << t.trg_tables << " ... " << flush;
+    const TrialResult r = ::run_trial_process(s, t);
+    if (!r.ok) {
+      cout << "failed" << endl;
+      continue;
+    }
+    const bool fits = r.peak_mb <= memory_limit;
+    cout << fixed << setprecision(1) << r.tokens_per_sec << " tokens/sec, "
+         << r.peak_mb << " MB" << (fits ? "" : " (over the limit)") << endl;
+    if (fits && r.tokens_per_sec > best_speed) {
+      best = i;
+      best_speed = r.tokens_per_sec;
+    }
+  }
+  return best;
+}
+
+// Writes the number of intra-op threads of the trial for each program, since
+// the best one differs among tasks.
+void write_intra_threads(
+    ofstream &ofs, const vector<string> &programs, const Trial &t) {
+  if (t.intra_threads == 0) return;
+  for (const string &program : programs) {
+    ofs << program << ":intra-threads " << t.intra_threads << '\n';
+  }
+}
+
+vector<unsigned> parse_list(const string &str) {
+  vector<unsigned> ret;
+  for (const string &s : ::split(str, ',')) {
+    const int value = stoi(s);
+    if (value <= 0) throw runtime_error("Invalid list: " + str);
+    ret.emplace_back(value);
+  }
+  return ret;
+}
+
+int main(int argc, char *argv[]) {
+  const auto opts = ::check_args(argc, argv, {
+      "(int) Source vocabulary size",
+      "(int) Target vocabulary size",
+      "(int) Embedding size",
+      "(int) Hidden size",
+#ifdef PRIMITIV_NMT_USE_CUDA
+      "(int) GPU ID",
+#endif
+      "(file/out) Config file of recommended options",
+  }, {
+      {"model-config", "",
+        "(dir/in) Model directory whose model config is used "
+        "(default: LSTM with global attention)"},
+      {"length", "50", "(int) Length of synthetic sentences"},
+      {"batches", "16,32,64,128,256",
+        "(str) Comma-separated batch sizes to try"},
+#ifndef PRIMITIV_NMT_USE_CUDA
+      {"threads", "",
+        "(str) Comma-separated numbers of threads to try "
+        "(empty: 1, 2, 4, ... and all cores)"},
+      {"intra-threads", "",
+        "(str) Comma-separated numbers of intra-op threads to try "
+        "(empty: 1 and all cores divided by threads, if built with OpenMP)"},
+#endif
+      {"steps", "5", "(int) Number of timed steps in each trial"},
+      {"memory-limit", "0",
+        "(int) Max peak memory of a process in MB "
+        "(0: 90% of the physical memory)"},
+  });
+
+  ::global_try_block([&]() {
+      TuneSetup s;
+      s.src_vocab_size = stoi(*++argv);
+      s.trg_vocab_size = stoi(*++argv);
+      s.embed_size = stoi(*++argv);
+      s.hidden_size = stoi(*++argv);
+#ifdef PRIMITIV_NMT_USE_CUDA
+      s.gpu_id = stoi(*++argv);
+      const vector<unsigned> thread_list {1};
+      const auto intra_list = [](unsigned) { return vector<unsigned> {0}; };
+#else
+      s.gpu_id = 0;
+      const unsigned num_cores = max(1u, thread::hardware_concurrency());
+      vector<unsigned> thread_list;
+      if (!opts.at("threads").empty()) {
+        thread_list = ::parse_list(opts.at("threads"));
+      } else {
+        for (unsigned n = 1; n < num_cores; n *= 2) thread_list.emplace_back(n);
+        thread_list.emplace_back(num_cores);
+      }
+      // Numbers of intra-op threads to try with `n` threads.
+      const auto intra_list = [&](unsigned n) {
+        if (!opts.at("intra-threads").empty()) {
+          return ::parse_list(opts.at("intra-threads"));
+        }
+#ifdef PRIMITIV_NMT_USE_OPENMP
+        const unsigned per_thread = max(1u, num_cores / n);
+        return per_thread > 1
+          ? vector<unsigned> {1, per_thread} : vector<unsigned> {1};
+#else
+        static_cast<void>(n);
+        return vector<unsigned> {0};
+#endif
+      };
+#endif
+      const string config_file = *++argv;
+      if (!opts.at("model-config").empty()) {
+        s.config = ::load_model_config(opts.at("model-config"));
+      }
+      s.length = stoi(opts.at("length"));
+      s.num_steps = max(1, stoi(opts.at("steps")));
+      const vector<unsigned> batch_list = ::parse_list(opts.at("batches"));
+      double memory_limit = stoi(opts.at("memory-limit"));
+      if (memory_limit == 0) {
+        memory_limit = 0.9 * ::sysconf(_SC_PHYS_PAGES)
+          * (::sysconf(_SC_PAGE_SIZE) / 1048576.);
+      }
+
+      vector<Trial> train_trials, translate_trials, score_trials;
+      for (unsigned n : thread_list) {
+        for (unsigned k : intra_list(n)) {
+          for (unsigned b : batch_list) {
+            train_trials.push_back(Trial { "train", n, k, b, false, false });
+            score_trials.push_back(Trial { "score", n, k, b, false, false });
+          }
+        }
+      }
+      for (unsigned k : intra_list(1)) {
+        for (bool src_tables : {false, true}) {
+          for (bool trg_tables : {false, true}) {
+            translate_trials.push_back(
+                Trial { "translate", 1, k, 1, src_tables, trg_tables });
+          }
+        }
+      }
+
+      const int best_train = ::find_best(s, train_trials, memory_limit);
+      const int best_translate = ::find_best(s, translate_trials, memory_limit);
+      const int best_score = ::find_best(s, score_trials, memory_limit);
+
+      ofstream ofs;
+      ::open_file(config_file, ofs);
+      ofs << "# Written by autotune with length " << s.length
+          << " and memory limit " << static_cast<unsigned>(memory_limit)
+          << " MB.\n";
+      if (best_train >= 0) {
+        const Trial &t = train_trials[best_train];
+        ofs << "# train, resume (batch size should be >= "
+            << t.batch_size << ")\n";
+        ofs << "workers " << t.num_threads << '\n';
+        ofs << "max-batch-tokens " << 2 * (s.length + 2) * t.batch_size << '\n';
+        ::write_intra_threads(ofs, {"train", "resume"}, t);
+      } else {
+        cerr << "WARNING: no training trial succeeded." << endl;
+      }
+      if (best_translate >= 0) {
+        const Trial &t = translate_trials[best_translate];
+        ofs << "# translate, translate_ensemble\n";
+        ofs << "src-tables " << t.src_tables << '\n';
+        ofs << "trg-tables " << t.trg_tables << '\n';
+        ::write_intra_threads(ofs, {"translate", "translate_ensemble"}, t);
+      } else {
+        cerr << "WARNING: no translation trial succeeded." << endl;
+      }
+      if (best_score >= 0) {
+        const Trial &t = score_trials[best_score];
+        ofs << "# score\n";
+#ifndef PRIMITIV_NMT_USE_CUDA
+        ofs << "threads " << t.num_threads << '\n';
+#endif
+        ofs << "batch " << t.batch_size << '\n';
+        ::write_intra_threads(ofs, {"score"}, t);
+      } else {
+        cerr << "WARNING: no scoring trial succeeded." << endl;
+      }
+      cout << "Wrote " << config_file << '.' << endl;
+  });
+
+  return 0;
+}
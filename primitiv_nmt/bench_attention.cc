@@ -0,0 +1,88 @@
+#include <primitiv_nmt/config.h>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <primitiv/primitiv.h>
+
+#include <primitiv_nmt/attention.h>
+#include <primitiv_nmt/utils.h>
+
+// Measures decoding time of global and local attention on synthetic inputs.
+int main(int argc, char *argv[]) {
+  const auto opts = ::check_args(argc, argv, {
+      "(int) Source length",
+      "(int) Target length",
+      "(int) Hidden size",
+      "(int) Number of trials",
+#ifdef PRIMITIV_NMT_USE_CUDA
+      "(int) GPU ID",
+#endif
+  }, {
+      {"windows", "0,2,5,10",
+        "(str) Comma-separated window sizes to measure (0: global)"},
+      {"batch", "1", "(int) Batch size"},
+  });
+
+  ::global_try_block([&]() {
+      namespace F = primitiv::functions;
+      const unsigned src_len = std::stoi(*++argv);
+      const unsigned trg_len = std::stoi(*++argv);
+      const unsigned hidden_size = std::stoi(*++argv);
+      const unsigned num_trials = std::stoi(*++argv);
+#ifdef PRIMITIV_NMT_USE_CUDA
+      const unsigned gpu_id = std::stoi(*++argv);
+#endif
+      const unsigned batch_size = std::stoi(opts.at("batch"));
+
+#ifdef PRIMITIV_NMT_USE_CUDA
+      primitiv::devices::CUDA dev(gpu_id);
+#else
+      primitiv::devices::Eigen dev;
+#endif
+      primitiv::Device::set_default(dev);
+
+      std::mt19937 rng(0);
+      std::uniform_real_distribution<float> dist(-1, 1);
+      auto make_input = [&](unsigned size) {
+        std::vector<float> data(size * batch_size);
+        for (float &x : data) x = dist(rng);
+        return F::input<primitiv::Tensor>(
+            primitiv::Shape({size}, batch_size), data);
+      };
+
+      std::vector<primitiv::Tensor> enc_states;
+      for (unsigned i = 0; i < src_len; ++i) {
+        enc_states.emplace_back(make_input(2 * hidden_size));
+      }
+      const primitiv::Tensor dec_state = make_input(hidden_size);
+
+      std::cout << "window\tms/sentence" << std::endl;
+      for (const auto &s : ::split(opts.at("windows"), ',')) {
+        ::Attention<primitiv::Tensor> att;
+        att.init(2 * hidden_size, hidden_size, hidden_size);
+        att.set_window(std::stoi(s));
+
+        primitiv::Tensor context;
+        const auto start = std::chrono::steady_clock::now();
+        for (unsigned n = 0; n < num_trials; ++n) {
+          att.reset(enc_states);
+          for (unsigned t = 0; t < trg_len; ++t) {
+            context = att.get_context(att.get_probs(dec_state));
+          }
+          // Waits for the device.
+          context.to_vector();
+        }
+        const std::chrono::duration<double, std::milli> elapsed =
+          std::chrono::steady_clock::now() - start;
+
+        std::cout << att.window() << '\t'
+                  << elapsed.count() / num_trials << std::endl;
+      }
+  });
+
+  return 0;
+}
@@ -0,0 +1,100 @@
+#include <primitiv_nmt/config.h>
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <primitiv/primitiv.h>
+
+#include <primitiv_nmt/sparse.h>
+#include <primitiv_nmt/utils.h>
+
+// Measures time of the dense and block sparse matrix products on random
+// weights pruned to several sparsities, and finds the crossover sparsity
+// above which the sparse kernel is faster.
+int main(int argc, char *argv[]) {
+  const auto opts = ::check_args(argc, argv, {
+      "(int) Rows of the weight matrix",
+      "(int) Columns of the weight matrix",
+      "(int) Number of input vectors (e.g., batch size)",
+      "(int) Number of trials",
+#ifdef PRIMITIV_NMT_USE_CUDA
+      "(int) GPU ID",
+#endif
+  }, {
+      {"sparsities", "0,0.5,0.7,0.8,0.9,0.95,0.98",
+        "(str) Comma-separated ratios of zero blocks to measure"},
+      {"block", "1x1", "(str) Block size <rows>x<cols>"},
+  });
+
+  ::global_try_block([&]() {
+      namespace F = primitiv::functions;
+      const unsigned rows = std::stoi(*++argv);
+      const unsigned cols = std::stoi(*++argv);
+      const unsigned num_inputs = std::stoi(*++argv);
+      const unsigned num_trials = std::stoi(*++argv);
+#ifdef PRIMITIV_NMT_USE_CUDA
+      const unsigned gpu_id = std::stoi(*++argv);
+#endif
+      const auto block = ::parse_block_size(opts.at("block"));
+
+#ifdef PRIMITIV_NMT_USE_CUDA
+      primitiv::devices::CUDA dev(gpu_id);
+#else
+      primitiv::devices::Eigen dev;
+#endif
+      primitiv::Device::set_default(dev);
+
+      std::mt19937 rng(0);
+      std::uniform_real_distribution<float> dist(-1, 1);
+      std::vector<float> dense(rows * cols), input(cols * num_inputs);
+      for (float &x : dense) x = dist(rng);
+      for (float &x : input) x = dist(rng);
+      const primitiv::Tensor x = F::input<primitiv::Tensor>(
+          primitiv::Shape({cols, num_inputs}), input);
+
+      // Returns milliseconds per product.
+      const auto measure = [&](const std::function<primitiv::Tensor()> &fn) {
+        fn().to_vector();
+        const auto start = std::chrono::steady_clock::now();
+        primitiv::Tensor y;
+        for (unsigned n = 0; n < num_trials; ++n) y = fn();
+        // Waits for the device.
+        y.to_vector();
+        const std::chrono::duration<double, std::milli> elapsed =
+          std::chrono::steady_clock::now() - start;
+        return elapsed.count() / num_trials;
+      };
+
+      std::cout << "sparsity\tdense ms\tsparse ms" << std::endl;
+      std::string crossover;
+      for (const auto &s : ::split(opts.at("sparsities"), ',')) {
+        std::vector<float> pruned = dense;
+        ::prune_blocks(
+            pruned, rows, cols, std::stof(s), block.first, block.second);
+        const ::BlockSparseMatrix sparse(
+            pruned, rows, cols, block.first, block.second);
+        const primitiv::Tensor w = F::input<primitiv::Tensor>(
+            primitiv::Shape({rows, cols}), pruned);
+
+        const double dense_ms = measure([&]() { return F::matmul(w, x); });
+        const double sparse_ms = measure([&]() {
+            return ::sparse_matmul(w, &sparse, x);
+        });
+        std::cout << sparse.sparsity() << '\t' << dense_ms << '\t'
+                  << sparse_ms << std::endl;
+        if (sparse_ms >= dense_ms) {
+          crossover.clear();
+        } else if (crossover.empty()) {
+          crossover = std::to_string(sparse.sparsity());
+        }
+      }
+      std::cout << "Crossover sparsity: "
+                << (crossover.empty() ? "none" : crossover) << std::endl;
+  });
+
+  return 0;
+}
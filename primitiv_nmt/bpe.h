@@ -0,0 +1,313 @@
+#ifndef PRIMITIV_NMT_BPE_H_
+#define PRIMITIV_NMT_BPE_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <primitiv_nmt/primitiv_nmt.pb.h>
+#include <primitiv_nmt/utils.h>
+
+// Byte-pair encoding (Sennrich et al., 2016).
+// Words are split into characters and the end-of-word marker "</w>" is
+// attached to the last character. Subwords except the last one in each word
+// are written with the "@@" suffix, e.g., "low@@ er".
+
+// Returns true if the word should not be segmented.
+inline bool is_special_word(const std::string &word) {
+  return word == "<unk>" || word == "<bos>" || word == "<eos>";
+}
+
+// Splits a word into UTF-8 characters.
+inline std::vector<std::string> split_chars(const std::string &word) {
+  std::vector<std::string> chars;
+  unsigned i = 0;
+  while (i < word.size()) {
+    const unsigned char c = word[i];
+    unsigned len = 1;
+    if ((c & 0xe0) == 0xc0) len = 2;
+    else if ((c & 0xf0) == 0xe0) len = 3;
+    else if ((c & 0xf8) == 0xf0) len = 4;
+    len = std::min<unsigned>(len, word.size() - i);
+    chars.emplace_back(word.substr(i, len));
+    i += len;
+  }
+  return chars;
+}
+
+// Restores words from subwords, i.e., removes all "@@ " in the line.
+inline std::string remove_bpe(const std::string &line) {
+  std::string ret;
+  ret.reserve(line.size());
+  unsigned i = 0;
+  while (i < line.size()) {
+    if (line.compare(i, 3, "@@ ") == 0) {
+      i += 3;
+    } else if (i + 2 == line.size() && line.compare(i, 2, "@@") == 0) {
+      break;
+    } else {
+      ret += line[i++];
+    }
+  }
+  return ret;
+}
+
+// Learns BPE merge operations from word frequencies.
+// Pair frequencies are updated only for words containing the merged pair,
+// and the most frequent pair is retrieved from a priority queue whose
+// outdated entries are skipped lazily.
+inline primitiv_nmt::proto::BPEModel learn_bpe(
+    const std::unordered_map<std::string, unsigned> &word_freq,
+    unsigned num_merges, unsigned min_freq) {
+  struct Word {
+    std::vector<unsigned> symbols;
+    std::int64_t freq;
+    unsigned last_merge;
+  };
+
+  // Symbol table.
+  std::vector<std::string> itos;
+  std::unordered_map<std::string, unsigned> stoi;
+  auto get_id = [&](const std::string &symbol) {
+    const auto it = stoi.find(symbol);
+    if (it != stoi.end()) return it->second;
+    stoi.emplace(symbol, itos.size());
+    itos.emplace_back(symbol);
+    return static_cast<unsigned>(itos.size() - 1);
+  };
+  auto make_key = [](unsigned left, unsigned right) {
+    return static_cast<std::uint64_t>(left) << 32 | right;
+  };
+
+  // Words are sorted to make results deterministic.
+  std::vector<std::pair<std::string, unsigned>> sorted_words(
+      word_freq.begin(), word_freq.end());
+  std::sort(sorted_words.begin(), sorted_words.end());
+  std::vector<Word> words;
+  words.reserve(sorted_words.size());
+  for (const auto &kv : sorted_words) {
+    std::vector<std::string> chars = ::split_chars(kv.first);
+    if (chars.empty()) continue;
+    chars.back() += "</w>";
+    Word word { {}, kv.second, 0 };
+    for (const std::string &c : chars) word.symbols.emplace_back(get_id(c));
+    words.emplace_back(std::move(word));
+  }
+
+  // Initial pair frequencies and the inverted index.
+  std::unordered_map<std::uint64_t, std::int64_t> pair_freq;
+  std::unordered_map<std::uint64_t, std::vector<unsigned>> where;
+  for (unsigned i = 0; i < words.size(); ++i) {
+    const auto &symbols = words[i].symbols;
+    for (unsigned j = 0; j + 1 < symbols.size(); ++j) {
+      const std::uint64_t key = make_key(symbols[j], symbols[j + 1]);
+      pair_freq[key] += words[i].freq;
+      auto &ids = where[key];
+      if (ids.empty() || ids.back() != i) ids.emplace_back(i);
+    }
+  }
+
+  using Entry = std::pair<std::int64_t, std::uint64_t>;
+  std::priority_queue<Entry> queue;
+  for (const auto &kv : pair_freq) queue.emplace(kv.second, kv.first);
+
+  primitiv_nmt::proto::BPEModel model;
+  for (unsigned n = 1; n <= num_merges; ++n) {
+    // Finds the most frequent pair.
+    std::uint64_t best_key = 0;
+    std::int64_t best_freq = 0;
+    while (!queue.empty()) {
+      const Entry top = queue.top();
+      queue.pop();
+      const auto it = pair_freq.find(top.second);
+      if (it != pair_freq.end() && it->second == top.first) {
+        best_freq = top.first;
+        best_key = top.second;
+        break;
+      }
+    }
+    if (best_freq < static_cast<std::int64_t>(std::max(min_freq, 1u))) break;
+
+    const unsigned left = best_key >> 32;
+    const unsigned right = best_key & 0xffffffff;
+    primitiv_nmt::proto::BPEMerge *merge = model.add_merges();
+    merge->set_left(itos[left]);
+    merge->set_right(itos[right]);
+    const unsigned merged = get_id(itos[left] + itos[right]);
+
+    // Updates only words which contain the pair.
+    std::vector<std::uint64_t> changed;
+    const std::vector<unsigned> ids = std::move(where[best_key]);
+    where.erase(best_key);
+    for (const unsigned i : ids) {
+      Word &word = words[i];
+      if (word.last_merge == n) continue;
+      word.last_merge = n;
+      auto &symbols = word.symbols;
+
+      bool found = false;
+      for (unsigned j = 0; j + 1 < symbols.size(); ++j) {
+        if (symbols[j] == left && symbols[j + 1] == right) {
+          found = true;
+          break;
+        }
+      }
+      if (!found) continue;
+
+      for (unsigned j = 0; j + 1 < symbols.size(); ++j) {
+        const std::uint64_t key = make_key(symbols[j], symbols[j + 1]);
+        pair_freq[key] -= word.freq;
+        changed.emplace_back(key);
+      }
+      std::vector<unsigned> new_symbols;
+      new_symbols.reserve(symbols.size());
+      for (unsigned j = 0; j < symbols.size(); ++j) {
+        if (j + 1 < symbols.size()
+            && symbols[j] == left && symbols[j + 1] == right) {
+          new_symbols.emplace_back(merged);
+          ++j;
+        } else {
+          new_symbols.emplace_back(symbols[j]);
+        }
+      }
+      symbols.swap(new_symbols);
+      for (unsigned j = 0; j + 1 < symbols.size(); ++j) {
+        const std::uint64_t key = make_key(symbols[j], symbols[j + 1]);
+        pair_freq[key] += word.freq;
+        changed.emplace_back(key);
+        if (symbols[j] == merged || symbols[j + 1] == merged) {
+          auto &ids = where[key];
+          if (ids.empty() || ids.back() != i) ids.emplace_back(i);
+        }
+      }
+    }
+
+    std::sort(changed.begin(), changed.end());
+    changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+    for (const std::uint64_t key : changed) {
+      const auto it = pair_freq.find(key);
+      if (it->second <= 0) pair_freq.erase(it);
+      else queue.emplace(it->second, key);
+    }
+    pair_freq.erase(best_key);
+
+    if (n % 1000 == 0) std::cout << n << '\r' << std::flush;
+  }
+
+  return model;
+}
+
+// Cache of segmented words.
+using BPECache = std::unordered_map<std::string, std::string>;
+
+// Applies learned BPE merge operations.
+class BPE {
+  std::unordered_map<std::string, unsigned> ranks_;
+
+  BPE(const BPE &) = delete;
+  BPE &operator=(const BPE &) = delete;
+
+public:
+  BPE(const std::string &path) {
+    primitiv_nmt::proto::BPEModel model;
+    ::load_proto(path, model);
+    for (int i = 0; i < model.merges_size(); ++i) {
+      const auto &merge = model.merges(i);
+      ranks_.emplace(merge.left() + ' ' + merge.right(), i);
+    }
+  }
+
+  // Segments a word into subwords joined by "@@ ".
+  std::string encode_word(const std::string &word) const {
+    if (::is_special_word(word)) return word;
+    std::vector<std::string> symbols = ::split_chars(word);
+    if (symbols.empty()) return word;
+    symbols.back() += "</w>";
+
+    while (symbols.size() > 1) {
+      // Finds the pair merged first.
+      unsigned best_rank = ranks_.size();
+      unsigned best_pos = 0;
+      for (unsigned i = 0; i + 1 < symbols.size(); ++i) {
+        const auto it = ranks_.find(symbols[i] + ' ' + symbols[i + 1]);
+        if (it != ranks_.end() && it->second < best_rank) {
+          best_rank = it->second;
+          best_pos = i;
+        }
+      }
+      if (best_rank == ranks_.size()) break;
+
+      // Merges all occurrences of the pair.
+      const std::string left = symbols[best_pos];
+      const std::string right = symbols[best_pos + 1];
+      std::vector<std::string> merged;
+      merged.reserve(symbols.size());
+      for (unsigned i = 0; i < symbols.size(); ++i) {
+        if (i >= best_pos && i + 1 < symbols.size()
+            && symbols[i] == left && symbols[i + 1] == right) {
+          merged.emplace_back(left + right);
+          ++i;
+        } else {
+          merged.emplace_back(std::move(symbols[i]));
+        }
+      }
+      symbols.swap(merged);
+    }
+
+    std::string ret;
+    for (unsigned i = 0; i + 1 < symbols.size(); ++i) {
+      ret += symbols[i] + "@@ ";
+    }
+    ret += symbols.back().substr(0, symbols.back().size() - 4);
+    return ret;
+  }
+
+  // Segments all words in the line. Results of each word are stored in
+  // `cache`.
+  std::string encode_line(const std::string &line, ::BPECache &cache) const {
+    std::string ret;
+    for (const std::string &word : ::split(line)) {
+      auto it = cache.find(word);
+      if (it == cache.end()) {
+        it = cache.emplace(word, encode_word(word)).first;
+      }
+      if (!ret.empty()) ret += ' ';
+      ret += it->second;
+    }
+    return ret;
+  }
+
+  // Segments lines in place using `num_threads` threads.
+  // Each thread has its own cache in `caches`, which should have at least
+  // `num_threads` elements.
+  void encode_lines(
+      std::vector<std::string> &lines, std::vector<::BPECache> &caches,
+      unsigned num_threads) const {
+    num_threads = std::max(1u, std::min<unsigned>(num_threads, lines.size()));
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < num_threads; ++t) {
+      threads.emplace_back([&, t]() {
+          for (unsigned i = t; i < lines.size(); i += num_threads) {
+            lines[i] = encode_line(lines[i], caches[t]);
+          }
+      });
+    }
+    for (std::thread &th : threads) th.join();
+  }
+};
+
+// Returns the number of threads to use, where 0 means all cores.
+inline unsigned get_num_threads(unsigned num_threads) {
+  if (num_threads > 0) return num_threads;
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+#endif  // PRIMITIV_NMT_BPE_H_
@@ -0,0 +1,164 @@
+#ifndef PRIMITIV_NMT_CHECKPOINT_H_
+#define PRIMITIV_NMT_CHECKPOINT_H_
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <primitiv/primitiv.h>
+
+#include <primitiv_nmt/cpu_affinity.h>
+#include <primitiv_nmt/data_parallel.h>
+#include <primitiv_nmt/utils.h>
+
+// In-memory copy of the optimizer configurations.
+struct OptimizerSnapshot {
+  std::unordered_map<std::string, std::uint32_t> uint_configs;
+  std::unordered_map<std::string, float> float_configs;
+
+  explicit OptimizerSnapshot(const primitiv::Optimizer &opt) {
+    opt.get_configs(uint_configs, float_configs);
+  }
+
+  // Saves configurations in the same format as primitiv::Optimizer::save().
+  void save(const std::string &path) const {
+    primitiv::optimizers::Adam opt;
+    opt.set_configs(uint_configs, float_configs);
+    opt.save(path);
+  }
+};
+
+// Retrieves names of checkpoint directories in `model_dir` in the order of
+// saving: "<epoch>", then "<epoch>.<step>" in the next epoch.
+inline std::vector<std::string> list_checkpoints(const std::string &model_dir) {
+  std::vector<std::pair<std::pair<unsigned, unsigned>, std::string>> dirs;
+  for (const std::string &name : ::list_directory(model_dir)) {
+    const std::size_t dot = name.find('.');
+    const std::string epoch = name.substr(0, dot);
+    const std::string step =
+      dot == std::string::npos ? "0" : name.substr(dot + 1);
+    const auto is_number = [](const std::string &str) {
+      return !str.empty() && std::all_of(
+          str.begin(), str.end(), [](char c) { return std::isdigit(c); });
+    };
+    if (!is_number(epoch) || !is_number(step)) continue;
+    dirs.emplace_back(
+        std::make_pair(std::stoi(epoch), std::stoi(step)), name);
+  }
+  std::sort(dirs.begin(), dirs.end());
+  std::vector<std::string> names;
+  for (const auto &dir : dirs) names.emplace_back(dir.second);
+  return names;
+}
+
+// Removes checkpoints in `model_dir` except the latest `num_keeps` ones and
+// the best epoch. 0 keeps all checkpoints. If `latest_optimizer_only` is
+// true, optimizer statistics saved separately are also removed except the
+// latest checkpoint. `in_use` (e.g., a checkpoint whose dev hyps are still
+// being written) is never removed.
+inline void remove_old_checkpoints(
+    const std::string &model_dir, unsigned num_keeps,
+    bool latest_optimizer_only, const std::string &in_use = "") {
+  const std::vector<std::string> names = ::list_checkpoints(model_dir);
+  std::string best_dir;
+  if (::path_exists(model_dir + "/best.epoch")) {
+    best_dir = ::get_model_dir(
+        model_dir, ::load_value<unsigned>(model_dir + "/best.epoch"));
+  }
+  for (unsigned i = 0; i + 1 < names.size(); ++i) {
+    const std::string dir = model_dir + '/' + names[i];
+    if (num_keeps > 0 && i + num_keeps < names.size()
+        && dir != best_dir && dir != in_use) {
+      ::remove_directory(dir);
+      continue;
+    }
+    const std::string opt_path = dir + "/optimizer.bin";
+    if (latest_optimizer_only && ::path_exists(opt_path)) {
+      std::remove(opt_path.c_str());
+    }
+  }
+}
+
+// Writes checkpoints, or runs other jobs, on a background thread.
+// At most one job is in flight: starting a new job waits for the previous
+// one, so that at most one snapshot is kept in memory.
+class CheckpointWriter {
+  primitiv::devices::Naive dev_;
+  std::thread thread_;
+  std::exception_ptr error_;
+
+  CheckpointWriter(const CheckpointWriter &) = delete;
+  CheckpointWriter &operator=(const CheckpointWriter &) = delete;
+
+public:
+  CheckpointWriter() = default;
+
+  ~CheckpointWriter() {
+    try {
+      wait();
+    } catch (const std::exception &ex) {
+      std::cerr << "Failed to write checkpoint: " << ex.what() << std::endl;
+    }
+  }
+
+  // Copies parameters and optimizer statistics of `src` to `dst` on `dev`, or
+  // on the host memory owned by this writer if `dev` is nullptr.
+  void snapshot(
+      const primitiv::Model &src, primitiv::Model &dst,
+      primitiv::Device *dev = nullptr) {
+    ::clone_parameters(src, dst, dev ? *dev : dev_, true);
+  }
+
+  // Waits for the current write, and rethrows its error if any.
+  void wait() {
+    if (thread_.joinable()) thread_.join();
+    if (error_) {
+      const std::exception_ptr error = error_;
+      error_ = nullptr;
+      std::rethrow_exception(error);
+    }
+  }
+
+  // Runs `job` on the background thread after the previous one finishes.
+  void run(const std::function<void()> &job) {
+    wait();
+    thread_ = std::thread([this, job]() {
+        // Dev hyps are decoded on this thread.
+        ::apply_intra_op_threads();
+        try {
+          job();
+        } catch (...) {
+          error_ = std::current_exception();
+        }
+    });
+  }
+
+  // Writes files into `dir` on the background thread.
+  // `write_files` receives a temporary directory, which is renamed to `dir`
+  // after all files are written. `on_finish` is called after renaming.
+  void write(
+      const std::string &dir,
+      const std::function<void(const std::string &)> &write_files,
+      const std::function<void()> &on_finish) {
+    run([dir, write_files, on_finish]() {
+        const std::string tmp_dir = dir + ".tmp";
+        if (::path_exists(tmp_dir)) ::remove_directory(tmp_dir);
+        ::make_directory(tmp_dir);
+        write_files(tmp_dir);
+        ::rename_path(tmp_dir, dir);
+        on_finish();
+    });
+  }
+};
+
+#endif  // PRIMITIV_NMT_CHECKPOINT_H_
@@ -0,0 +1,248 @@
+#ifndef PRIMITIV_NMT_COMPRESSED_MODEL_H_
+#define PRIMITIV_NMT_COMPRESSED_MODEL_H_
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+#include <primitiv/primitiv.h>
+
+#include <primitiv_nmt/utils.h>
+
+// File format of parameters, which is used instead of primitiv::Model::save()
+// when checkpoints are compressed or optimizer statistics are stored
+// separately.
+//
+// Each file holds either values or statistics of all parameters:
+//   "PNMTPARM" <#params:u32>
+//   for each parameter:
+//     <name> <#dims:u32> <dims:u32...> <#arrays:u32>
+//     for each array:
+//       <array name ("" for values)> <codec:u32> <#bytes:u64> <bytes>
+// where strings are written as <length:u32> <chars>. With the zlib codec,
+// bytes of floats are shuffled (all 1st bytes, all 2nd bytes, ...) before
+// compression, which groups similar exponent bytes together.
+
+namespace compressed_model_internal {
+
+const char MAGIC[] = "PNMTPARM";
+enum Codec : std::uint32_t { RAW = 0, ZLIB = 1 };
+
+template<typename T>
+inline void write_value(std::ofstream &ofs, T value) {
+  ofs.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template<typename T>
+inline T read_value(std::ifstream &ifs) {
+  T value;
+  if (!ifs.read(reinterpret_cast<char *>(&value), sizeof(T))) {
+    throw std::runtime_error("Unexpected end of the parameter file.");
+  }
+  return value;
+}
+
+inline void write_string(std::ofstream &ofs, const std::string &str) {
+  write_value<std::uint32_t>(ofs, str.size());
+  ofs.write(str.data(), str.size());
+}
+
+inline std::string read_string(std::ifstream &ifs) {
+  std::string str(read_value<std::uint32_t>(ifs), '\0');
+  if (!ifs.read(&str[0], str.size())) {
+    throw std::runtime_error("Unexpected end of the parameter file.");
+  }
+  return str;
+}
+
+inline void write_array(
+    std::ofstream &ofs, const std::string &name,
+    const std::vector<float> &values, bool compress) {
+  write_string(ofs, name);
+  const std::size_t num_bytes = values.size() * sizeof(float);
+  const unsigned char *src =
+    reinterpret_cast<const unsigned char *>(values.data());
+  if (!compress) {
+    write_value<std::uint32_t>(ofs, RAW);
+    write_value<std::uint64_t>(ofs, num_bytes);
+    ofs.write(reinterpret_cast<const char *>(src), num_bytes);
+    return;
+  }
+
+  std::vector<unsigned char> shuffled(num_bytes);
+  for (std::size_t i = 0; i < values.size(); ++i) {
+    for (std::size_t k = 0; k < sizeof(float); ++k) {
+      shuffled[k * values.size() + i] = src[i * sizeof(float) + k];
+    }
+  }
+  ::uLongf size = ::compressBound(num_bytes);
+  std::vector<unsigned char> compressed(size);
+  if (::compress2(
+        compressed.data(), &size, shuffled.data(), num_bytes,
+        Z_BEST_SPEED) != Z_OK) {
+    throw std::runtime_error("Failed to compress parameters.");
+  }
+  write_value<std::uint32_t>(ofs, ZLIB);
+  write_value<std::uint64_t>(ofs, size);
+  ofs.write(reinterpret_cast<const char *>(compressed.data()), size);
+}
+
+inline std::vector<float> read_array(std::ifstream &ifs, std::size_t size) {
+  const std::uint32_t codec = read_value<std::uint32_t>(ifs);
+  const std::uint64_t num_bytes = read_value<std::uint64_t>(ifs);
+  std::vector<unsigned char> data(num_bytes);
+  if (!ifs.read(reinterpret_cast<char *>(data.data()), num_bytes)) {
+    throw std::runtime_error("Unexpected end of the parameter file.");
+  }
+  std::vector<float> values(size);
+  unsigned char *dest = reinterpret_cast<unsigned char *>(values.data());
+  if (codec == RAW) {
+    if (num_bytes != size * sizeof(float)) {
+      throw std::runtime_error("Invalid size of the parameter array.");
+    }
+    std::memcpy(dest, data.data(), num_bytes);
+    return values;
+  }
+  if (codec != ZLIB) throw std::runtime_error("Unknown codec.");
+
+  std::vector<unsigned char> shuffled(size * sizeof(float));
+  ::uLongf out_size = shuffled.size();
+  if (::uncompress(
+        shuffled.data(), &out_size, data.data(), num_bytes) != Z_OK
+      || out_size != shuffled.size()) {
+    throw std::runtime_error("Failed to decompress parameters.");
+  }
+  for (std::size_t i = 0; i < size; ++i) {
+    for (std::size_t k = 0; k < sizeof(float); ++k) {
+      dest[i * sizeof(float) + k] = shuffled[k * size + i];
+    }
+  }
+  return values;
+}
+
+inline std::string join_path(const std::vector<std::string> &path) {
+  std::string name;
+  for (const std::string &p : path) name += (name.empty() ? "" : ".") + p;
+  return name;
+}
+
+}  // namespace compressed_model_internal
+
+// Saves values, or optimizer statistics if `stats` is true, of all
+// parameters of the model.
+inline void save_parameters(
+    const primitiv::Model &model, const std::string &path,
+    bool stats, bool compress) {
+  namespace I = compressed_model_internal;
+  std::ofstream ofs;
+  ::open_file(path, ofs);
+  ofs.write(I::MAGIC, 8);
+  const auto params = model.get_all_parameters();
+  I::write_value<std::uint32_t>(ofs, params.size());
+  for (const auto &kv : params) {
+    const primitiv::Parameter &param = *kv.second;
+    const primitiv::Shape &shape = param.shape();
+    I::write_string(ofs, I::join_path(kv.first));
+    I::write_value<std::uint32_t>(ofs, shape.depth());
+    for (unsigned i = 0; i < shape.depth(); ++i) {
+      I::write_value<std::uint32_t>(ofs, shape[i]);
+    }
+
+    if (!stats) {
+      I::write_value<std::uint32_t>(ofs, 1);
+      I::write_array(ofs, "", param.value().to_vector(), compress);
+      continue;
+    }
+    std::vector<std::string> stats_names;
+    // Statistics used by primitiv::optimizers::Adam.
+    for (const std::string name : {"adam-m1", "adam-m2"}) {
+      if (param.has_stats(name)) stats_names.emplace_back(name);
+    }
+    I::write_value<std::uint32_t>(ofs, stats_names.size());
+    for (const std::string &name : stats_names) {
+      I::write_array(ofs, name, param.stats(name).to_vector(), compress);
+    }
+  }
+  if (!ofs) throw std::runtime_error("Failed to write parameters: " + path);
+}
+
+// Loads parameters saved by save_parameters(). Values initialize parameters
+// on the default device. Statistics can be loaded only into initialized
+// parameters.
+inline void load_parameters(primitiv::Model &model, const std::string &path) {
+  namespace I = compressed_model_internal;
+  std::ifstream ifs;
+  ::open_file(path, ifs);
+  char magic[8];
+  if (!ifs.read(magic, 8) || std::memcmp(magic, I::MAGIC, 8) != 0) {
+    throw std::runtime_error("Invalid parameter file: " + path);
+  }
+  const auto params = model.get_all_parameters();
+  const std::uint32_t num_params = I::read_value<std::uint32_t>(ifs);
+  if (num_params != params.size()) {
+    throw std::runtime_error("Model structures mismatched: " + path);
+  }
+  for (const auto &kv : params) {
+    primitiv::Parameter &param = *kv.second;
+    if (I::read_string(ifs) != I::join_path(kv.first)) {
+      throw std::runtime_error("Model structures mismatched: " + path);
+    }
+    std::vector<unsigned> dims(I::read_value<std::uint32_t>(ifs));
+    for (unsigned &d : dims) d = I::read_value<std::uint32_t>(ifs);
+    const primitiv::Shape shape(dims);
+
+    const std::uint32_t num_arrays = I::read_value<std::uint32_t>(ifs);
+    for (std::uint32_t i = 0; i < num_arrays; ++i) {
+      const std::string name = I::read_string(ifs);
+      const std::vector<float> values = I::read_array(ifs, shape.size());
+      if (name.empty()) {
+        param.init(shape, values);
+        continue;
+      }
+      if (!param.valid() || param.shape() != shape) {
+        throw std::runtime_error(
+            "Values should be loaded before statistics: " + path);
+      }
+      if (!param.has_stats(name)) param.add_stats(name, shape);
+      param.stats(name).reset_by_vector(values);
+    }
+  }
+}
+
+// Saves the model into the checkpoint directory. If `packed` is true,
+// values and optimizer statistics are saved separately into "model.bin" and
+// "optimizer.bin" by save_parameters(), otherwise both are saved into "model"
+// by primitiv::Model::save().
+inline void save_checkpoint_model(
+    const primitiv::Model &model, const std::string &dir,
+    bool packed, bool compress) {
+  if (!packed) {
+    model.save(dir + "/model");
+    return;
+  }
+  ::save_parameters(model, dir + "/model.bin", false, compress);
+  ::save_parameters(model, dir + "/optimizer.bin", true, compress);
+}
+
+// Loads the model saved in the checkpoint directory in either format:
+// "model" saved by primitiv::Model::save(), or "model.bin" and optionally
+// "optimizer.bin" saved by save_parameters(). Returns whether optimizer
+// statistics were found if `with_stats` is true.
+inline bool load_checkpoint_model(
+    primitiv::Model &model, const std::string &dir, bool with_stats) {
+  if (::path_exists(dir + "/model")) {
+    model.load(dir + "/model", with_stats);
+    return true;
+  }
+  ::load_parameters(model, dir + "/model.bin");
+  if (!with_stats || !::path_exists(dir + "/optimizer.bin")) return false;
+  ::load_parameters(model, dir + "/optimizer.bin");
+  return true;
+}
+
+#endif  // PRIMITIV_NMT_COMPRESSED_MODEL_H_
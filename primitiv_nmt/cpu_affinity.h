@@ -0,0 +1,221 @@
+#ifndef PRIMITIV_NMT_CPU_AFFINITY_H_
+#define PRIMITIV_NMT_CPU_AFFINITY_H_
+
+#include <condition_variable>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifdef PRIMITIV_NMT_USE_OPENMP
+#include <omp.h>
+#endif
+
+#include <primitiv_nmt/utils.h>
+
+// Number of intra-op threads requested by set_intra_op_threads().
+// 0 means the default of the OpenMP runtime.
+inline unsigned &intra_op_threads() {
+  static unsigned num_threads = 0;
+  return num_threads;
+}
+
+// Applies the number of intra-op threads to the calling thread.
+// OpenMP keeps this setting for each thread, hence every thread which
+// calculates tensors should call this first.
+inline void apply_intra_op_threads() {
+#ifdef PRIMITIV_NMT_USE_OPENMP
+  if (::intra_op_threads() > 0) ::omp_set_num_threads(::intra_op_threads());
+#endif
+}
+
+// Sets the number of threads used by each tensor operation of the Eigen
+// device. This is effective only if primitiv and this program are built with
+// OpenMP.
+inline void set_intra_op_threads(unsigned num_threads) {
+#ifndef PRIMITIV_NMT_USE_OPENMP
+  if (num_threads > 0) {
+    std::cerr << "WARNING: built without OpenMP, --intra-threads is ignored."
+              << std::endl;
+  }
+#endif
+  ::intra_op_threads() = num_threads;
+  ::apply_intra_op_threads();
+}
+
+// Parses a CPU list, e.g., "0-3,8,10-11".
+inline std::vector<unsigned> parse_cpu_list(const std::string &str) {
+  std::vector<unsigned> cpus;
+  for (const std::string &range : ::split(str, ',')) {
+    if (range.empty()) continue;
+    const std::size_t dash = range.find('-');
+    const int first = std::stoi(range.substr(0, dash));
+    const int last = dash == std::string::npos
+      ? first : std::stoi(range.substr(dash + 1));
+    if (first < 0 || last < first) {
+      throw std::runtime_error("Invalid CPU list: " + str);
+    }
+    for (int i = first; i <= last; ++i) cpus.emplace_back(i);
+  }
+  if (cpus.empty()) throw std::runtime_error("Empty CPU list: " + str);
+  return cpus;
+}
+
+// Retrieves CPUs of the NUMA node.
+inline std::vector<unsigned> get_numa_node_cpus(unsigned node) {
+  const std::string path =
+    "/sys/devices/system/node/node" + std::to_string(node) + "/cpulist";
+  std::ifstream ifs(path);
+  std::string line;
+  if (!std::getline(ifs, line)) {
+    throw std::runtime_error("Unknown NUMA node: " + std::to_string(node));
+  }
+  return ::parse_cpu_list(line);
+}
+
+// Pins the calling thread to the CPUs. Threads created afterwards by the
+// calling thread inherit the affinity.
+inline void pin_to_cpus(const std::vector<unsigned> &cpus) {
+  ::cpu_set_t set;
+  CPU_ZERO(&set);
+  for (unsigned cpu : cpus) {
+    if (cpu >= CPU_SETSIZE) {
+      throw std::runtime_error("Too large CPU ID: " + std::to_string(cpu));
+    }
+    CPU_SET(cpu, &set);
+  }
+  if (::sched_setaffinity(0, sizeof(set), &set) != 0) {
+    throw std::runtime_error("Could not set the CPU affinity.");
+  }
+}
+
+// Makes memory pages first touched by the calling thread be allocated on the
+// NUMA node if possible (MPOL_PREFERRED).
+inline void prefer_numa_node(unsigned node) {
+  const unsigned bits = 8 * sizeof(unsigned long);
+  std::vector<unsigned long> mask(node / bits + 1, 0);
+  mask[node / bits] = 1ul << (node % bits);
+  const int mpol_preferred = 1;  // MPOL_PREFERRED in <linux/mempolicy.h>
+  if (::syscall(
+        SYS_set_mempolicy, mpol_preferred, mask.data(),
+        mask.size() * bits + 1) != 0) {
+    throw std::runtime_error(
+        "Could not set the memory policy for NUMA node "
+        + std::to_string(node));
+  }
+}
+
+// Runs the calling thread on CPUs of the NUMA node, and allocates its memory
+// there.
+inline void bind_to_numa_node(unsigned node) {
+  ::pin_to_cpus(::get_numa_node_cpus(node));
+  ::prefer_numa_node(node);
+}
+
+// Applies --intra-threads, --cpus and --numa-node options to the calling
+// thread. This should be called before other threads start and tensors are
+// allocated.
+inline void apply_cpu_options(const std::map<std::string, std::string> &opts) {
+  ::set_intra_op_threads(std::stoi(opts.at("intra-threads")));
+  const int node = std::stoi(opts.at("numa-node"));
+  if (node >= 0) ::bind_to_numa_node(node);
+  if (!opts.at("cpus").empty()) {
+    ::pin_to_cpus(::parse_cpu_list(opts.at("cpus")));
+  }
+}
+
+// Threads which are bound to NUMA nodes and repeatedly run the same function
+// for each thread ID together, e.g., to run each model of an ensemble on its
+// own socket. Memory allocated by each thread is placed on its node.
+class PinnedWorkers {
+  std::vector<std::thread> threads_;
+  std::mutex mutex_;
+  std::condition_variable start_cv_, done_cv_;
+  const std::function<void(unsigned)> *fn_;
+  unsigned generation_;
+  unsigned num_running_;
+  bool stopped_;
+  std::exception_ptr error_;
+
+  PinnedWorkers(const PinnedWorkers &) = delete;
+  PinnedWorkers &operator=(const PinnedWorkers &) = delete;
+
+  void loop(unsigned id) {
+    ::apply_intra_op_threads();
+    unsigned generation = 0;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      start_cv_.wait(lock, [&]() {
+          return stopped_ || generation_ != generation;
+      });
+      if (stopped_) return;
+      generation = generation_;
+      lock.unlock();
+      std::exception_ptr error;
+      try {
+        (*fn_)(id);
+      } catch (...) {
+        error = std::current_exception();
+      }
+      lock.lock();
+      if (error && !error_) error_ = error;
+      if (--num_running_ == 0) done_cv_.notify_one();
+    }
+  }
+
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopped_ = true;
+    }
+    start_cv_.notify_all();
+    for (std::thread &th : threads_) th.join();
+  }
+
+public:
+  // Makes one thread for each NUMA node in `nodes`.
+  explicit PinnedWorkers(const std::vector<unsigned> &nodes)
+    : fn_(nullptr), generation_(0), num_running_(0), stopped_(false) {
+    for (unsigned i = 0; i < nodes.size(); ++i) {
+      threads_.emplace_back(&PinnedWorkers::loop, this, i);
+    }
+    try {
+      run([&](unsigned i) { ::bind_to_numa_node(nodes[i]); });
+    } catch (...) {
+      stop();
+      throw;
+    }
+  }
+
+  ~PinnedWorkers() { stop(); }
+
+  // Runs fn(0), ..., fn(size() - 1) on the corresponding threads and waits
+  // for all of them. Rethrows an exception thrown by any of them.
+  void run(const std::function<void(unsigned)> &fn) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    fn_ = &fn;
+    num_running_ = threads_.size();
+    ++generation_;
+    start_cv_.notify_all();
+    done_cv_.wait(lock, [&]() { return num_running_ == 0; });
+    if (error_) {
+      std::exception_ptr error = error_;
+      error_ = nullptr;
+      std::rethrow_exception(error);
+    }
+  }
+
+  unsigned size() const { return threads_.size(); }
+};
+
+#endif  // PRIMITIV_NMT_CPU_AFFINITY_H_
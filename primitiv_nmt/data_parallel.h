@@ -0,0 +1,291 @@
+#ifndef PRIMITIV_NMT_DATA_PARALLEL_H_
+#define PRIMITIV_NMT_DATA_PARALLEL_H_
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <primitiv/primitiv.h>
+
+#include <primitiv_nmt/cpu_affinity.h>
+#include <primitiv_nmt/encoder_decoder.h>
+#include <primitiv_nmt/sampled_softmax.h>
+#include <primitiv_nmt/sampler.h>
+
+// Runs fn(0), ..., fn(n - 1) on separate threads and waits for all of them.
+inline void parallel_for(unsigned n, const std::function<void(unsigned)> &fn) {
+  std::vector<std::thread> threads;
+  threads.reserve(n);
+  for (unsigned i = 0; i < n; ++i) {
+    threads.emplace_back([&fn, i]() {
+        ::apply_intra_op_threads();
+        fn(i);
+    });
+  }
+  for (std::thread &th : threads) th.join();
+}
+
+// Splits a batch into at most n sub-batches along the batch axis.
+inline std::vector<Batch> split_batch(const Batch &batch, unsigned n) {
+  const unsigned batch_size = batch.source[0].size();
+  const unsigned num_parts = std::min(n, batch_size);
+  std::vector<Batch> parts(num_parts);
+  unsigned first = 0;
+  for (unsigned i = 0; i < num_parts; ++i) {
+    const unsigned second =
+      first + batch_size / num_parts + (i < batch_size % num_parts);
+    Batch &part = parts[i];
+    for (const auto &ids : batch.source) {
+      part.source.emplace_back(ids.begin() + first, ids.begin() + second);
+    }
+    for (const auto &ids : batch.target) {
+      part.target.emplace_back(ids.begin() + first, ids.begin() + second);
+    }
+    first = second;
+  }
+  return parts;
+}
+
+// Retrieves all parameters in the order of their names.
+inline std::vector<primitiv::Parameter *> get_parameters(
+    const primitiv::Model &model) {
+  std::vector<primitiv::Parameter *> params;
+  for (const auto &kv : model.get_all_parameters()) {
+    params.emplace_back(kv.second);
+  }
+  return params;
+}
+
+// Initializes all parameters in `dst` on `dev` by copying values of `src`.
+// If `with_stats` is true, optimizer statistics are also copied.
+// Both models should have the same structure.
+inline void clone_parameters(
+    const primitiv::Model &src, primitiv::Model &dst, primitiv::Device &dev,
+    bool with_stats = false) {
+  const auto src_params = ::get_parameters(src);
+  const auto dst_params = ::get_parameters(dst);
+  if (src_params.size() != dst_params.size()) {
+    throw std::runtime_error("Model structures mismatched.");
+  }
+  for (unsigned i = 0; i < src_params.size(); ++i) {
+    const primitiv::Parameter &sp = *src_params[i];
+    primitiv::Parameter &dp = *dst_params[i];
+    dp.init(sp.shape(), sp.value().to_vector(), &dev);
+    if (!with_stats) continue;
+    // Statistics used by primitiv::optimizers::Adam.
+    for (const std::string name : {"adam-m1", "adam-m2"}) {
+      if (!sp.has_stats(name)) continue;
+      dp.add_stats(name, sp.shape());
+      dp.stats(name).reset_by_vector(sp.stats(name).to_vector());
+    }
+  }
+}
+
+// Set of model replicas for data-parallel training on CPU.
+// Replica 0 is the master model which owns the optimizer. Other replicas
+// live on their own devices, and are synchronized with the master after each
+// update.
+class ReplicaSet {
+public:
+  struct Replica {
+    primitiv::Device *dev;
+    ::EncoderDecoder<primitiv::Node> *model;
+    std::vector<primitiv::Parameter *> params;
+    std::vector<float> grads;
+  };
+
+private:
+  std::vector<std::unique_ptr<primitiv::Device>> devs_;
+  std::vector<std::unique_ptr<::EncoderDecoder<primitiv::Node>>> models_;
+  std::vector<Replica> replicas_;
+  std::vector<unsigned> offsets_;
+  std::vector<float> values_;
+  ::NegativeSampler *neg_sampler_;
+  unsigned recompute_segment_;
+
+  // Graph construction relies on the default graph/device, hence is
+  // serialized. Forward/backward calculations run concurrently.
+  std::mutex graph_mutex_;
+
+  ReplicaSet(const ReplicaSet &) = delete;
+  ReplicaSet &operator=(const ReplicaSet &) = delete;
+
+public:
+  ReplicaSet(
+      ::EncoderDecoder<primitiv::Node> &model, primitiv::Device &dev,
+      unsigned num_replicas)
+    : neg_sampler_(nullptr)
+    , recompute_segment_(0) {
+    if (num_replicas == 0) {
+      throw std::runtime_error("Number of workers should be >= 1.");
+    }
+#ifdef PRIMITIV_NMT_USE_CUDA
+    if (num_replicas > 1) {
+      throw std::runtime_error("Multiple workers are supported only on CPU.");
+    }
+#endif
+    replicas_.push_back(Replica { &dev, &model, ::get_parameters(model), {} });
+    for (unsigned i = 1; i < num_replicas; ++i) {
+#ifndef PRIMITIV_NMT_USE_CUDA
+      devs_.emplace_back(new primitiv::devices::Eigen());
+#endif
+      models_.emplace_back(
+          new ::EncoderDecoder<primitiv::Node>(model.config()));
+      ::clone_parameters(model, *models_.back(), *devs_.back());
+      replicas_.push_back(Replica {
+          devs_.back().get(), models_.back().get(),
+          ::get_parameters(*models_.back()), {} });
+    }
+    unsigned total = 0;
+    for (const primitiv::Parameter *param : replicas_[0].params) {
+      offsets_.emplace_back(total);
+      total += param->shape().size();
+    }
+    offsets_.emplace_back(total);
+    for (Replica &rep : replicas_) rep.grads.resize(total);
+    values_.resize(total);
+  }
+
+  // Calculates gradients of a batch on the i-th replica multiplied by
+  // `scale`, and leaves them in its parameters.
+  // Different replicas can be used by different threads at the same time.
+  // With sampled softmax, `neg_ids` are used as negative samples if given,
+  // otherwise they are drawn for this batch.
+  // Returns the loss summed over the batch.
+  float backward(
+      unsigned i, const Batch &batch, float scale,
+      const std::vector<unsigned> *neg_ids = nullptr) {
+    Replica &rep = replicas_[i];
+    const unsigned batch_size = batch.source[0].size();
+    float loss_value;
+    if (recompute_segment_ > 0) {
+      for (primitiv::Parameter *param : rep.params) param->reset_gradient();
+      loss_value = batch_size * rep.model->backward_recomputed(
+          batch.source, batch.target, recompute_segment_, scale,
+          &graph_mutex_);
+    } else {
+      primitiv::Graph g;
+      primitiv::Node loss, scaled_loss;
+      {
+        std::lock_guard<std::mutex> lock(graph_mutex_);
+        primitiv::Graph::set_default(g);
+        primitiv::Device::set_default(*rep.dev);
+        rep.model->encode(batch.source);
+        rep.model->init_decoder();
+        loss = ::training_loss(*rep.model, batch, neg_sampler_, neg_ids);
+        scaled_loss = loss * scale;
+      }
+      loss_value = g.forward(loss).to_float() * batch_size;
+      for (primitiv::Parameter *param : rep.params) param->reset_gradient();
+      g.backward(scaled_loss);
+    }
+    return loss_value;
+  }
+
+  // Same as backward(), but also stores gradients into the flattened
+  // gradient buffer of the replica.
+  float compute_gradients(
+      unsigned i, const Batch &batch, float scale,
+      const std::vector<unsigned> *neg_ids = nullptr) {
+    const float loss_value = backward(i, batch, scale, neg_ids);
+    Replica &rep = replicas_[i];
+    unsigned pos = 0;
+    for (primitiv::Parameter *param : rep.params) {
+      const std::vector<float> grad = param->gradient().to_vector();
+      std::copy(grad.begin(), grad.end(), rep.grads.begin() + pos);
+      pos += grad.size();
+    }
+    return loss_value;
+  }
+
+  // Calculates the gradient of the whole batch on the master model using all
+  // replicas. Returns the loss summed over the batch.
+  float forward_backward(const Batch &batch) {
+    const std::vector<Batch> parts = ::split_batch(batch, replicas_.size());
+    const unsigned num_parts = parts.size();
+    const unsigned batch_size = batch.source[0].size();
+    std::vector<float> losses(num_parts);
+
+    // All sub-batches share the negative samples of the whole batch.
+    std::vector<unsigned> neg_ids;
+    if (neg_sampler_) neg_ids = neg_sampler_->sample();
+
+    ::parallel_for(num_parts, [&](unsigned i) {
+        const float scale =
+          static_cast<float>(parts[i].source[0].size()) / batch_size;
+        losses[i] = compute_gradients(
+            i, parts[i], scale, neg_sampler_ ? &neg_ids : nullptr);
+    });
+
+    // All-reduce: each thread sums up one slice of the gradient buffers.
+    const unsigned total = offsets_.back();
+    ::parallel_for(num_parts, [&](unsigned i) {
+        const unsigned first = total / num_parts * i;
+        const unsigned last = i + 1 == num_parts
+          ? total : total / num_parts * (i + 1);
+        float *dest = replicas_[0].grads.data();
+        for (unsigned j = 1; j < num_parts; ++j) {
+          const float *src = replicas_[j].grads.data();
+          for (unsigned k = first; k < last; ++k) dest[k] += src[k];
+        }
+    });
+
+    const Replica &master = replicas_[0];
+    for (unsigned i = 0; i < master.params.size(); ++i) {
+      master.params[i]->gradient().reset_by_array(
+          master.grads.data() + offsets_[i]);
+    }
+
+    restore_default_device();
+
+    float accum_loss = 0;
+    for (float loss : losses) accum_loss += loss;
+    return accum_loss;
+  }
+
+  // Copies updated parameters of the master model to other replicas.
+  void broadcast() {
+    const Replica &master = replicas_[0];
+    for (unsigned i = 0; i < master.params.size(); ++i) {
+      const std::vector<float> value = master.params[i]->value().to_vector();
+      std::copy(value.begin(), value.end(), values_.begin() + offsets_[i]);
+    }
+    ::parallel_for(replicas_.size() - 1, [&](unsigned i) {
+        load_values(i + 1, values_.data());
+    });
+  }
+
+  // Overwrites parameters of the i-th replica by flattened values.
+  void load_values(unsigned i, const float *values) {
+    const Replica &rep = replicas_[i];
+    for (unsigned j = 0; j < rep.params.size(); ++j) {
+      rep.params[j]->value().reset_by_array(values + offsets_[j]);
+    }
+  }
+
+  // Enables sampled softmax using given sampler, or disables it by nullptr.
+  void set_negative_sampler(::NegativeSampler *sampler) {
+    neg_sampler_ = sampler;
+  }
+
+  // Enables recomputation of activations in segments of given steps, or
+  // disables it by 0. See EncoderDecoder::backward_recomputed().
+  void set_recompute_segment(unsigned segment_size) {
+    recompute_segment_ = segment_size;
+  }
+
+  // Sets the master device back to the default device after using replicas.
+  void restore_default_device() {
+    primitiv::Device::set_default(*replicas_[0].dev);
+  }
+
+  Replica &replica(unsigned i) { return replicas_[i]; }
+  const std::vector<unsigned> &offsets() const { return offsets_; }
+  unsigned size() const { return replicas_.size(); }
+};
+
+#endif  // PRIMITIV_NMT_DATA_PARALLEL_H_
@@ -0,0 +1,266 @@
+#ifndef PRIMITIV_NMT_DISTRIBUTED_H_
+#define PRIMITIV_NMT_DISTRIBUTED_H_
+
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <primitiv_nmt/primitiv_nmt.pb.h>
+#include <primitiv_nmt/utils.h>
+
+// Keeps only samples of the corpus assigned to the given rank.
+inline void shard_corpus(
+    primitiv_nmt::proto::Corpus &corpus, unsigned rank, unsigned world_size) {
+  if (world_size <= 1) return;
+  primitiv_nmt::proto::Corpus shard;
+  for (int i = rank; i < corpus.samples_size(); i += world_size) {
+    shard.add_samples()->Swap(corpus.mutable_samples(i));
+  }
+  corpus.Swap(&shard);
+}
+
+// Makes "host:port" addresses of all ranks from a comma-separated list.
+// If only one address is given, all ranks run on the same host and listen on
+// consecutive ports.
+inline std::vector<std::string> make_addresses(
+    const std::string &hosts, unsigned world_size) {
+  std::vector<std::string> addrs = ::split(hosts, ',');
+  if (addrs.size() == 1 && world_size > 1) {
+    const std::size_t colon = addrs[0].rfind(':');
+    if (colon == std::string::npos) {
+      throw std::runtime_error(
+          "Invalid address (should be host:port): " + addrs[0]);
+    }
+    const std::string host = addrs[0].substr(0, colon);
+    const unsigned port = std::stoi(addrs[0].substr(colon + 1));
+    addrs.clear();
+    for (unsigned i = 0; i < world_size; ++i) {
+      addrs.emplace_back(host + ':' + std::to_string(port + i));
+    }
+  }
+  return addrs;
+}
+
+// Communicator between processes connected by a ring of TCP sockets.
+// Each rank listens on its own address, and connects to the next rank.
+class RingCommunicator {
+  const unsigned rank_;
+  const unsigned world_size_;
+  int prev_fd_;
+  int next_fd_;
+
+  RingCommunicator(const RingCommunicator &) = delete;
+  RingCommunicator &operator=(const RingCommunicator &) = delete;
+
+  static void throw_error(const std::string &what) {
+    throw std::runtime_error(what + ": " + std::strerror(errno));
+  }
+
+  // Splits "host:port".
+  static void parse_address(
+      const std::string &addr, std::string &host, std::string &port) {
+    const std::size_t colon = addr.rfind(':');
+    if (colon == std::string::npos) {
+      throw std::runtime_error(
+          "Invalid address (should be host:port): " + addr);
+    }
+    host = addr.substr(0, colon);
+    port = addr.substr(colon + 1);
+  }
+
+  static ::addrinfo *resolve(const std::string &addr, bool passive) {
+    std::string host, port;
+    parse_address(addr, host, port);
+    ::addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (passive) hints.ai_flags = AI_PASSIVE;
+    ::addrinfo *res = nullptr;
+    const int ret = ::getaddrinfo(
+        passive ? nullptr : host.c_str(), port.c_str(), &hints, &res);
+    if (ret != 0) {
+      throw std::runtime_error(
+          "Failed to resolve " + addr + ": " + ::gai_strerror(ret));
+    }
+    return res;
+  }
+
+  static void set_nodelay(int fd) {
+    int flag = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+  }
+
+  static int listen_on(const std::string &addr) {
+    ::addrinfo *res = resolve(addr, true);
+    const int fd = ::socket(
+        res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd < 0) throw_error("Failed to create socket");
+    int flag = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+    if (::bind(fd, res->ai_addr, res->ai_addrlen) != 0) {
+      ::freeaddrinfo(res);
+      throw_error("Failed to bind " + addr);
+    }
+    ::freeaddrinfo(res);
+    if (::listen(fd, 1) != 0) throw_error("Failed to listen " + addr);
+    return fd;
+  }
+
+  // Connects to the given address. Retries until the peer starts listening.
+  static int connect_to(const std::string &addr, unsigned timeout_sec) {
+    for (unsigned i = 0; ; ++i) {
+      ::addrinfo *res = resolve(addr, false);
+      const int fd = ::socket(
+          res->ai_family, res->ai_socktype, res->ai_protocol);
+      if (fd < 0) throw_error("Failed to create socket");
+      const int ret = ::connect(fd, res->ai_addr, res->ai_addrlen);
+      ::freeaddrinfo(res);
+      if (ret == 0) {
+        set_nodelay(fd);
+        return fd;
+      }
+      ::close(fd);
+      if (i >= timeout_sec) throw_error("Failed to connect " + addr);
+      ::sleep(1);
+    }
+  }
+
+  static void send_all(int fd, const void *data, std::size_t size) {
+    const char *p = static_cast<const char *>(data);
+    while (size > 0) {
+      const ::ssize_t n = ::send(fd, p, size, 0);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        throw_error("Failed to send data");
+      }
+      p += n;
+      size -= n;
+    }
+  }
+
+  static void recv_all(int fd, void *data, std::size_t size) {
+    char *p = static_cast<char *>(data);
+    while (size > 0) {
+      const ::ssize_t n = ::recv(fd, p, size, 0);
+      if (n == 0) throw std::runtime_error("Connection closed by peer.");
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        throw_error("Failed to receive data");
+      }
+      p += n;
+      size -= n;
+    }
+  }
+
+  // Sends data to the next rank and receives data from the previous rank at
+  // the same time.
+  void exchange(
+      const float *send_data, unsigned send_size,
+      float *recv_data, unsigned recv_size) {
+    std::exception_ptr send_error;
+    std::thread sender([&]() {
+        try {
+          send_all(next_fd_, send_data, send_size * sizeof(float));
+        } catch (...) {
+          send_error = std::current_exception();
+        }
+    });
+    try {
+      recv_all(prev_fd_, recv_data, recv_size * sizeof(float));
+    } catch (...) {
+      sender.join();
+      throw;
+    }
+    sender.join();
+    if (send_error) std::rethrow_exception(send_error);
+  }
+
+public:
+  // `addrs` are "host:port" addresses of all ranks.
+  RingCommunicator(
+      unsigned rank, unsigned world_size,
+      const std::vector<std::string> &addrs)
+    : rank_(rank), world_size_(world_size), prev_fd_(-1), next_fd_(-1) {
+    if (rank >= world_size) {
+      throw std::runtime_error(
+          "Invalid rank: " + std::to_string(rank)
+          + " (world size: " + std::to_string(world_size) + ")");
+    }
+    if (world_size == 1) return;
+    if (addrs.size() != world_size) {
+      throw std::runtime_error(
+          "Number of addresses should be equal to the world size.");
+    }
+    const int listen_fd = listen_on(addrs[rank]);
+    next_fd_ = connect_to(addrs[(rank + 1) % world_size], 600);
+    prev_fd_ = ::accept(listen_fd, nullptr, nullptr);
+    ::close(listen_fd);
+    if (prev_fd_ < 0) throw_error("Failed to accept connection");
+    set_nodelay(prev_fd_);
+  }
+
+  ~RingCommunicator() {
+    if (prev_fd_ >= 0) ::close(prev_fd_);
+    if (next_fd_ >= 0) ::close(next_fd_);
+  }
+
+  // Sums up data over all ranks in place (ring all-reduce).
+  void all_reduce(std::vector<float> &data) {
+    const unsigned n = world_size_;
+    if (n == 1) return;
+    const unsigned size = data.size();
+    auto first = [&](unsigned chunk) { return size / n * (chunk % n); };
+    auto last = [&](unsigned chunk) {
+      return chunk % n == n - 1 ? size : size / n * (chunk % n + 1);
+    };
+    std::vector<float> buf(size - size / n * (n - 1));
+
+    // Reduce-scatter: rank r obtains the sum of chunk (r + 1).
+    for (unsigned step = 0; step < n - 1; ++step) {
+      const unsigned send_chunk = rank_ + n - step;
+      const unsigned recv_chunk = rank_ + n - step - 1;
+      const unsigned recv_size = last(recv_chunk) - first(recv_chunk);
+      exchange(
+          data.data() + first(send_chunk),
+          last(send_chunk) - first(send_chunk),
+          buf.data(), recv_size);
+      float *dest = data.data() + first(recv_chunk);
+      for (unsigned i = 0; i < recv_size; ++i) dest[i] += buf[i];
+    }
+
+    // All-gather.
+    for (unsigned step = 0; step < n - 1; ++step) {
+      const unsigned send_chunk = rank_ + n + 1 - step;
+      const unsigned recv_chunk = rank_ + n - step;
+      exchange(
+          data.data() + first(send_chunk),
+          last(send_chunk) - first(send_chunk),
+          data.data() + first(recv_chunk),
+          last(recv_chunk) - first(recv_chunk));
+    }
+  }
+
+  // Returns the value given by rank 0.
+  float broadcast(float value) {
+    std::vector<float> data { rank_ == 0 ? value : 0.f };
+    all_reduce(data);
+    return data[0];
+  }
+
+  unsigned rank() const { return rank_; }
+  unsigned world_size() const { return world_size_; }
+};
+
+#endif  // PRIMITIV_NMT_DISTRIBUTED_H_
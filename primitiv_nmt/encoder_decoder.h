@@ -3,143 +3,572 @@
 
 #include <algorithm>
 #include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 #include <primitiv/primitiv.h>
 
+#include <primitiv_nmt/adaptive_softmax.h>
 #include <primitiv_nmt/affine.h>
 #include <primitiv_nmt/attention.h>
 #include <primitiv_nmt/lstm.h>
+#include <primitiv_nmt/primitiv_nmt.pb.h>
+#include <primitiv_nmt/recurrent_cell.h>
+#include <primitiv_nmt/sru.h>
 #include <primitiv_nmt/utils.h>
 
+// Loads the model configuration saved in the model directory.
+// Returns the default configuration if it does not exist.
+inline primitiv_nmt::proto::ModelConfig load_model_config(
+    const std::string &model_dir) {
+  primitiv_nmt::proto::ModelConfig config;
+  const std::string path = model_dir + "/config";
+  if (::path_exists(path)) ::load_proto(path, config);
+  return config;
+}
+
+// Makes a recurrent cell by its name. Empty name means LSTM.
+template<typename Var>
+inline ::RecurrentCell<Var> *make_recurrent_cell(const std::string &name) {
+  if (name.empty() || name == "lstm") return new ::LSTM<Var>();
+  if (name == "sru") return new ::SRU<Var>();
+  throw std::runtime_error("Unknown recurrent cell: " + name);
+}
+
 template<typename Var>
 class EncoderDecoder : public primitiv::Model {
-  primitiv::Parameter psrc_emb_, ptrg_emb_;
-  ::LSTM<Var> rnn_fw_, rnn_bw_, rnn_dec_;
+  primitiv::Parameter psrc_emb_, ptrg_emb_, ptrg_bias_;
+  std::unique_ptr<::RecurrentCell<Var>> rnn_fw_, rnn_bw_, rnn_dec_;
   ::Attention<Var> att_;
   ::Affine<Var> aff_fbd_, aff_cdj_, aff_jy_;
+  std::unique_ptr<::AdaptiveSoftmax<Var>> adaptive_;
+  primitiv_nmt::proto::ModelConfig config_;
   Var d_, j_;
   Var trg_emb_;
   Var dec_c0_;
+  Var src_fw_table_, src_bw_table_, trg_table_, dec_wj_;
+  std::vector<unsigned> trg_ids_;
 
-public:
-  // New object.
-  EncoderDecoder() {
-    add("src_emb", psrc_emb_);
-    add("trg_emb", ptrg_emb_);
-    add("rnn_fw", rnn_fw_);
-    add("rnn_bw", rnn_bw_);
-    add("rnn_dec", rnn_dec_);
-    add("att", att_);
-    add("aff_fbd", aff_fbd_);
-    add("aff_cdj", aff_cdj_);
-    add("aff_jy", aff_jy_);
-  }
-
-  // Initializes parameters.
-  void init(
-      unsigned src_vocab_size, unsigned trg_vocab_size,
-      unsigned embed_size, unsigned hidden_size) {
-    namespace I = primitiv::initializers;
-    psrc_emb_.init({embed_size, src_vocab_size}, I::Uniform(-0.1, 0.1));
-    ptrg_emb_.init({embed_size, trg_vocab_size}, I::Uniform(-0.1, 0.1));
-    rnn_fw_.init(embed_size, hidden_size);
-    rnn_bw_.init(embed_size, hidden_size);
-    rnn_dec_.init(2 * embed_size, hidden_size);
-    att_.init(2 * hidden_size, hidden_size, hidden_size);
-    aff_fbd_.init(2 * hidden_size, hidden_size);
-    aff_cdj_.init(3 * hidden_size, embed_size);
-    aff_jy_.init(embed_size, trg_vocab_size);
+  // Calculates the next hidden state of the output layer.
+  void decode_hidden(const Var &att_probs) {
+    namespace F = primitiv::functions;
+    const Var c = att_.get_context(att_probs);
+    j_ = F::tanh(aff_cdj_.forward(F::concat({c, d_}, 0)));
   }
 
-  // Encodes source batch and initializes decoder states.
-  void encode(const std::vector<std::vector<unsigned>> &src_batch) {
+  // Encodes source batch, calculates the initial decoder state, and returns
+  // encoder states of all positions.
+  std::vector<Var> encode_states(
+      const std::vector<std::vector<unsigned>> &src_batch) {
     namespace F = primitiv::functions;
 
     const unsigned src_len = src_batch.size();
     const Var invalid;
 
     // Source embedding
-    const Var src_emb = F::parameter<Var>(psrc_emb_);
+    const bool use_tables = src_fw_table_.valid();
     std::vector<Var> e_list;
-    for (const auto &x : src_batch) {
-      e_list.emplace_back(F::pick(src_emb, x, 1));
+    if (!use_tables) {
+      const Var src_emb = F::parameter<Var>(psrc_emb_);
+      for (const auto &x : src_batch) {
+        e_list.emplace_back(F::pick(src_emb, x, 1));
+      }
     }
 
     // Forward encoding
-    rnn_fw_.reset(invalid, invalid);
+    rnn_fw_->reset(invalid, invalid);
     std::vector<Var> f_list;
-    for (const Var &e : e_list) {
-      f_list.emplace_back(rnn_fw_.forward(e));
+    if (use_tables) {
+      for (unsigned i = 0; i < src_len; ++i) {
+        f_list.emplace_back(rnn_fw_->forward_projected(
+              F::pick(src_fw_table_, src_batch[i], 1)));
+      }
+    } else {
+      f_list = rnn_fw_->forward_sequence(e_list);
     }
 
     // Backward encoding
-    rnn_bw_.reset(invalid, invalid);
+    rnn_bw_->reset(invalid, invalid);
     std::vector<Var> b_list;
-    for (auto it = e_list.rbegin(); it != e_list.rend(); ++it) {
-      b_list.emplace_back(rnn_bw_.forward(*it));
+    if (use_tables) {
+      for (unsigned i = src_len; i > 0; --i) {
+        b_list.emplace_back(rnn_bw_->forward_projected(
+              F::pick(src_bw_table_, src_batch[i - 1], 1)));
+      }
+    } else {
+      std::reverse(e_list.begin(), e_list.end());
+      b_list = rnn_bw_->forward_sequence(e_list);
     }
     std::reverse(b_list.begin(), b_list.end());
 
-    // Preparing decoder states
+    // Initial decoder state
     aff_fbd_.reset();
-    aff_cdj_.reset();
-    aff_jy_.reset();
-    const Var last_fb = F::concat({rnn_fw_.get_c(), rnn_bw_.get_c()}, 0);
+    const Var last_fb = F::concat({rnn_fw_->get_c(), rnn_bw_->get_c()}, 0);
     dec_c0_ = aff_fbd_.forward(last_fb);
 
-    // Making matrix for calculating attention
     std::vector<Var> fb_list;
     for (unsigned i = 0; i < src_len; ++i) {
       fb_list.emplace_back(F::concat({f_list[i], b_list[i]}, 0));
     }
-    att_.reset(fb_list);
+    return fb_list;
+  }
+
+  // Prepares the output layer and attention over encoder states.
+  void prepare_decoder(const std::vector<Var> &enc_states) {
+    namespace F = primitiv::functions;
 
-    // Other parameters
+    // Target embedding
     trg_emb_ = F::parameter<Var>(ptrg_emb_);
+
+    aff_cdj_.reset();
+    if (adaptive_) {
+      adaptive_->reset();
+    } else {
+      if (config_.tie_target_embedding()) {
+        aff_jy_.reset(trg_emb_, F::parameter<Var>(ptrg_bias_), true);
+      } else {
+        aff_jy_.reset();
+      }
+      if (!trg_ids_.empty()) aff_jy_.restrict_rows(trg_ids_);
+    }
+
+    att_.reset(enc_states);
+  }
+
+  // Calculates the loss of one decoding step.
+  Var step_loss(
+      const std::vector<unsigned> &trg_words,
+      const std::vector<unsigned> &gold_words) {
+    const Var att_probs = decode_atten(trg_words);
+    if (adaptive_) {
+      decode_hidden(att_probs);
+      return adaptive_->loss(j_, gold_words);
+    }
+    return primitiv::functions::softmax_cross_entropy(
+        decode_word(att_probs), gold_words, 0);
+  }
+
+public:
+  // New object with the default configuration.
+  EncoderDecoder() : EncoderDecoder(primitiv_nmt::proto::ModelConfig()) {}
+
+  // New object with given configuration.
+  explicit EncoderDecoder(const primitiv_nmt::proto::ModelConfig &config)
+    : rnn_fw_(::make_recurrent_cell<Var>(config.rnn_cell()))
+    , rnn_bw_(::make_recurrent_cell<Var>(config.rnn_cell()))
+    , rnn_dec_(::make_recurrent_cell<Var>(config.rnn_cell()))
+    , config_(config) {
+    add("src_emb", psrc_emb_);
+    add("trg_emb", ptrg_emb_);
+    add("rnn_fw", *rnn_fw_);
+    add("rnn_bw", *rnn_bw_);
+    add("rnn_dec", *rnn_dec_);
+    add("att", att_);
+    att_.set_window(config_.attention_window());
+    add("aff_fbd", aff_fbd_);
+    add("aff_cdj", aff_cdj_);
+    if (config_.adaptive_softmax_cutoffs_size() > 0) {
+      if (config_.tie_target_embedding()) {
+        throw std::runtime_error(
+            "Tied embedding can not be used with adaptive softmax.");
+      }
+      adaptive_.reset(new ::AdaptiveSoftmax<Var>(
+            config_.adaptive_softmax_cutoffs_size()));
+      add("adaptive", *adaptive_);
+    } else if (config_.tie_target_embedding()) {
+      add("trg_bias", ptrg_bias_);
+    } else {
+      add("aff_jy", aff_jy_);
+    }
+  }
+
+  // Initializes parameters.
+  void init(
+      unsigned src_vocab_size, unsigned trg_vocab_size,
+      unsigned embed_size, unsigned hidden_size) {
+    namespace I = primitiv::initializers;
+    psrc_emb_.init({embed_size, src_vocab_size}, I::Uniform(-0.1, 0.1));
+    ptrg_emb_.init({embed_size, trg_vocab_size}, I::Uniform(-0.1, 0.1));
+    rnn_fw_->init(embed_size, hidden_size);
+    rnn_bw_->init(embed_size, hidden_size);
+    rnn_dec_->init(2 * embed_size, hidden_size);
+    att_.init(2 * hidden_size, hidden_size, hidden_size);
+    aff_fbd_.init(2 * hidden_size, hidden_size);
+    aff_cdj_.init(3 * hidden_size, embed_size);
+    if (adaptive_) {
+      const auto &cutoffs = config_.adaptive_softmax_cutoffs();
+      adaptive_->init(
+          embed_size, trg_vocab_size,
+          std::vector<unsigned>(cutoffs.begin(), cutoffs.end()));
+    } else if (config_.tie_target_embedding()) {
+      ptrg_bias_.init({trg_vocab_size}, I::Constant(0));
+    } else {
+      aff_jy_.init(embed_size, trg_vocab_size);
+    }
+  }
+
+  // Encodes source batch and initializes decoder states.
+  void encode(const std::vector<std::vector<unsigned>> &src_batch) {
+    prepare_decoder(encode_states(src_batch));
   }
 
   // Initializes decoder states
   void init_decoder() {
-    rnn_dec_.reset(dec_c0_, Var());
-    j_ = primitiv::functions::zeros<Var>({embed_size()});
+    rnn_dec_->reset(dec_c0_, Var());
+    j_ = primitiv::functions::zeros<Var>(
+        {embed_size()}, ptrg_emb_.device());
   }
 
   // Calculates next attention probabilities
   Var decode_atten(const std::vector<unsigned> &trg_words) {
     namespace F = primitiv::functions;
-    const Var e = F::pick(trg_emb_, trg_words, 1);
-    d_ = rnn_dec_.forward(F::concat({e, j_}, 0));
+    if (trg_table_.valid()) {
+      d_ = rnn_dec_->forward_projected(
+          F::pick(trg_table_, trg_words, 1) + F::matmul(dec_wj_, j_));
+    } else {
+      const Var e = F::pick(trg_emb_, trg_words, 1);
+      d_ = rnn_dec_->forward(F::concat({e, j_}, 0));
+    }
     return att_.get_probs(d_);
   }
 
+  // Uses sparse kernels for weight matrices whose blocks are zero at least
+  // `min_sparsity`, e.g., ones pruned by the `prune` tool. Only for
+  // inference: parameters should not be changed afterwards.
+  void make_sparse(
+      float min_sparsity, unsigned block_rows, unsigned block_cols) {
+    static_assert(
+        std::is_same<Var, primitiv::Tensor>::value,
+        "Sparse kernels are available only for inference using tensors.");
+    rnn_fw_->make_sparse(min_sparsity, block_rows, block_cols);
+    rnn_bw_->make_sparse(min_sparsity, block_rows, block_cols);
+    rnn_dec_->make_sparse(min_sparsity, block_rows, block_cols);
+    att_.make_sparse(min_sparsity, block_rows, block_cols);
+    aff_fbd_.make_sparse(min_sparsity, block_rows, block_cols);
+    aff_cdj_.make_sparse(min_sparsity, block_rows, block_cols);
+    if (!adaptive_ && !config_.tie_target_embedding()) {
+      aff_jy_.make_sparse(min_sparsity, block_rows, block_cols);
+    }
+  }
+
+  // Precomputes W_x . e + b of recurrent cells for all source and/or
+  // target words, so that encode() and decode_atten() look up columns of
+  // these tables instead of multiplying embeddings. Each table holds
+  // 4 * hidden_size values per word. Only for inference: parameters should
+  // not be changed afterwards.
+  void precompute_tables(bool src, bool trg) {
+    namespace F = primitiv::functions;
+    static_assert(
+        std::is_same<Var, primitiv::Tensor>::value,
+        "Lookup tables are available only for inference using tensors.");
+    const unsigned embed = embed_size();
+    src_fw_table_ = src_bw_table_ = trg_table_ = dec_wj_ = Var();
+    if (src) {
+      const Var src_emb = F::parameter<Var>(psrc_emb_);
+      const unsigned vocab = src_vocab_size();
+      src_fw_table_ = F::matmul(rnn_fw_->get_wx(0, embed), src_emb)
+        + F::broadcast(rnn_fw_->get_b(), 1, vocab);
+      src_bw_table_ = F::matmul(rnn_bw_->get_wx(0, embed), src_emb)
+        + F::broadcast(rnn_bw_->get_b(), 1, vocab);
+    }
+    if (trg) {
+      const Var trg_emb = F::parameter<Var>(ptrg_emb_);
+      trg_table_ = F::matmul(rnn_dec_->get_wx(0, embed), trg_emb)
+        + F::broadcast(rnn_dec_->get_b(), 1, trg_vocab_size());
+      dec_wj_ = rnn_dec_->get_wx(embed, 2 * embed);
+    }
+  }
+
   // Calculates next words
   Var decode_word(const Var &att_probs) {
-    namespace F = primitiv::functions;
-    const Var c = att_.get_context(att_probs);
-    j_ = F::tanh(aff_cdj_.forward(F::concat({c, d_}, 0)));
+    decode_hidden(att_probs);
+    if (adaptive_) return adaptive_->log_probs(j_);
     return aff_jy_.forward(j_);
   }
 
+  // Calculates log probabilities of next words. Unlike decode_word(), scores
+  // are comparable among different models.
+  Var decode_log_probs(const Var &att_probs) {
+    namespace F = primitiv::functions;
+    if (adaptive_) return decode_word(att_probs);
+    return F::log_softmax(decode_word(att_probs), 0);
+  }
+
+  // Calculates the most probable next word IDs of each batch.
+  // Only the resulting IDs are copied from the device.
+  std::vector<unsigned> decode_greedy(const Var &att_probs) {
+    decode_hidden(att_probs);
+    if (adaptive_) return adaptive_->argmax(j_);
+    std::vector<unsigned> ids = aff_jy_.forward(j_).argmax(0);
+    for (unsigned &id : ids) id = to_word_id(id);
+    return ids;
+  }
+
+  // Calculates the loss function using sampled softmax.
+  // `neg_ids` are sorted negative samples shared by all positions, and
+  // `log_q` holds the log of expected counts of each word in the samples.
+  // Negative samples equal to the gold word are ignored.
+  Var sampled_loss(
+      const std::vector<std::vector<unsigned>> &trg_batch,
+      const std::vector<unsigned> &neg_ids,
+      const std::vector<float> &log_q) {
+    namespace F = primitiv::functions;
+    if (adaptive_) {
+      throw std::runtime_error(
+          "Sampled softmax can not be used with adaptive softmax.");
+    }
+    primitiv::Device &dev = ptrg_emb_.device();
+    const unsigned batch_size = trg_batch[0].size();
+    const unsigned num_negs = neg_ids.size();
+
+    Var neg_w, neg_b;
+    aff_jy_.select_rows(neg_ids, neg_w, neg_b);
+    std::vector<float> neg_log_q;
+    for (const unsigned id : neg_ids) neg_log_q.emplace_back(log_q[id]);
+    const Var neg_bias = neg_b - F::input<Var>({num_negs}, neg_log_q, dev);
+    const std::vector<unsigned> gold_pos(batch_size, 0);
+
+    std::vector<Var> losses;
+    for (unsigned i = 0; i < trg_batch.size() - 1; ++i) {
+      const std::vector<unsigned> &gold_ids = trg_batch[i + 1];
+      decode_hidden(decode_atten(trg_batch[i]));
+
+      std::vector<float> gold_log_q;
+      std::vector<float> mask(num_negs * batch_size, 0);
+      bool masked = false;
+      for (unsigned b = 0; b < batch_size; ++b) {
+        gold_log_q.emplace_back(log_q[gold_ids[b]]);
+        const auto it = std::lower_bound(
+            neg_ids.begin(), neg_ids.end(), gold_ids[b]);
+        if (it != neg_ids.end() && *it == gold_ids[b]) {
+          mask[b * num_negs + (it - neg_ids.begin())] = -1e10;
+          masked = true;
+        }
+      }
+
+      const Var gold_y = aff_jy_.forward_picked(j_, gold_ids)
+        - F::input<Var>(primitiv::Shape({1}, batch_size), gold_log_q, dev);
+      Var neg_y = F::matmul(neg_w, j_) + neg_bias;
+      if (masked) {
+        neg_y = neg_y
+          + F::input<Var>(primitiv::Shape({num_negs}, batch_size), mask, dev);
+      }
+      losses.emplace_back(F::softmax_cross_entropy(
+            F::concat({gold_y, neg_y}, 0), gold_pos, 0));
+    }
+    return F::batch::mean(F::sum(losses));
+  }
+
+  // Restricts target words scored by decode_word() to `trg_ids`, which
+  // should be sorted. Takes effect from the next encode(). An empty list
+  // removes the restriction.
+  void restrict_targets(const std::vector<unsigned> &trg_ids) {
+    if (adaptive_ && !trg_ids.empty()) {
+      throw std::runtime_error(
+          "Target words can not be restricted with adaptive softmax.");
+    }
+    trg_ids_ = trg_ids;
+  }
+
+  // Converts an index of scores returned by decode_word() to the word ID.
+  unsigned to_word_id(unsigned index) const {
+    return trg_ids_.empty() ? index : trg_ids_[index];
+  }
+
   // Calculates the loss function.
   Var loss(const std::vector<std::vector<unsigned>> &trg_batch) {
     namespace F = primitiv::functions;
+    return F::batch::mean(F::sum(token_losses(trg_batch), 0));
+  }
 
+  // Calculates negative log likelihoods of each target word following the
+  // first one, as {trg_len - 1} x batch_size values.
+  Var token_losses(const std::vector<std::vector<unsigned>> &trg_batch) {
     std::vector<Var> losses;
     for (unsigned i = 0; i < trg_batch.size() - 1; ++i) {
-      const Var att_probs = decode_atten(trg_batch[i]);
-      const Var y = decode_word(att_probs);
-      losses.emplace_back(F::softmax_cross_entropy(y, trg_batch[i + 1], 0));
+      losses.emplace_back(step_loss(trg_batch[i], trg_batch[i + 1]));
     }
-    return F::batch::mean(F::sum(losses));
+    return primitiv::functions::concat(losses, 0);
+  }
+
+  // Calculates gradients of loss() multiplied by `scale`, recomputing
+  // activations instead of keeping them (gradient checkpointing).
+  // Only decoder states at every `segment_size` steps are kept after the
+  // first forward pass, and each segment is built again in its own graph
+  // during the backward pass, so that the peak memory is bounded by one
+  // segment instead of the whole sentence. The encoder is also recomputed.
+  // Gradients are added to those of parameters. Returns the value of loss().
+  // If `graph_mutex` is given, it is locked during graph construction.
+  float backward_recomputed(
+      const std::vector<std::vector<unsigned>> &src_batch,
+      const std::vector<std::vector<unsigned>> &trg_batch,
+      unsigned segment_size, float scale,
+      std::mutex *graph_mutex = nullptr) {
+    namespace F = primitiv::functions;
+    static_assert(
+        std::is_same<Var, primitiv::Node>::value,
+        "Recomputation is available only for training using nodes.");
+    if (segment_size == 0) {
+      throw std::runtime_error("Segment size should be >= 1.");
+    }
+    primitiv::Device &dev = ptrg_emb_.device();
+    const unsigned src_len = src_batch.size();
+    const unsigned num_steps = trg_batch.size() - 1;
+    const unsigned num_segments = (num_steps + segment_size - 1) / segment_size;
+    const unsigned batch_size = trg_batch[0].size();
+    const unsigned enc_size = 2 * hidden_size();
+    const primitiv::Shape enc_shape({enc_size, src_len}, batch_size);
+    const primitiv::Shape dec_shape({hidden_size()}, batch_size);
+    const primitiv::Shape j_shape({embed_size()}, batch_size);
+
+    // Graph construction relies on the default graph.
+    const auto build = [&](
+        primitiv::Graph &g, const std::function<void()> &func) {
+      std::unique_lock<std::mutex> lock;
+      if (graph_mutex) lock = std::unique_lock<std::mutex>(*graph_mutex);
+      primitiv::Graph::set_default(g);
+      func();
+    };
+
+    // Stored states are passed to each segment through parameters, which
+    // receive their gradients. Values of batched {size} x batch_size
+    // tensors are held by {size, batch_size} matrices, and vice versa.
+    const auto make_param = [&](
+        primitiv::Parameter &param, const std::vector<float> &values,
+        unsigned size) {
+      param.init({size, static_cast<unsigned>(values.size()) / size},
+          values, &dev);
+      param.reset_gradient();
+    };
+    const auto unbatch = [&](const Var &x, unsigned len, unsigned pos) {
+      std::vector<unsigned> ids;
+      for (unsigned b = 0; b < batch_size; ++b) ids.emplace_back(b * len + pos);
+      return F::pick(x, ids, 1);
+    };
+
+    // Forward pass of the encoder.
+    std::vector<float> enc_values;
+    std::vector<std::vector<float>> cs(num_segments), hs(num_segments);
+    std::vector<std::vector<float>> js(num_segments);
+    {
+      primitiv::Graph g;
+      Var enc;
+      build(g, [&]() { enc = F::concat(encode_states(src_batch), 1); });
+      enc_values = enc.to_vector();
+      cs[0] = dec_c0_.to_vector();
+      js[0].assign(j_shape.size(), 0);
+      // hs[0] is empty: the initial hidden state is calculated from cs[0].
+    }
+    primitiv::Parameter penc;
+    make_param(penc, enc_values, enc_size);
+
+    // Builds the k-th segment of the decoder from stored states.
+    // Returns the loss if `with_loss` is true.
+    const auto decode_segment = [&](
+        unsigned k, bool with_loss,
+        primitiv::Parameter &pc, primitiv::Parameter &ph,
+        primitiv::Parameter &pj) {
+      const Var enc = F::parameter<Var>(penc);
+      std::vector<Var> enc_states;
+      for (unsigned i = 0; i < src_len; ++i) {
+        enc_states.emplace_back(unbatch(enc, src_len, i));
+      }
+      prepare_decoder(enc_states);
+      make_param(pc, cs[k], hidden_size());
+      Var h;
+      if (!hs[k].empty()) {
+        make_param(ph, hs[k], hidden_size());
+        h = unbatch(F::parameter<Var>(ph), 1, 0);
+      }
+      rnn_dec_->reset(unbatch(F::parameter<Var>(pc), 1, 0), h);
+      make_param(pj, js[k], embed_size());
+      j_ = unbatch(F::parameter<Var>(pj), 1, 0);
+      att_.set_step(k * segment_size);
+
+      const unsigned last = std::min(num_steps, (k + 1) * segment_size);
+      std::vector<Var> losses;
+      for (unsigned i = k * segment_size; i < last; ++i) {
+        if (with_loss) {
+          losses.emplace_back(step_loss(trg_batch[i], trg_batch[i + 1]));
+        } else {
+          decode_hidden(decode_atten(trg_batch[i]));
+        }
+      }
+      return with_loss ? F::batch::mean(F::sum(losses)) : Var();
+    };
+
+    // Forward pass of the decoder, keeping states at segment boundaries.
+    for (unsigned k = 0; k + 1 < num_segments; ++k) {
+      primitiv::Graph g;
+      primitiv::Parameter pc, ph, pj;
+      build(g, [&]() { decode_segment(k, false, pc, ph, pj); });
+      cs[k + 1] = rnn_dec_->get_c().to_vector();
+      hs[k + 1] = rnn_dec_->get_h().to_vector();
+      js[k + 1] = j_.to_vector();
+    }
+
+    // Backward pass of the decoder from the last segment. Gradients of the
+    // last states of each segment are given by the next segment.
+    float loss_value = 0;
+    std::vector<float> gc, gh, gj;
+    for (unsigned k = num_segments; k-- > 0; ) {
+      primitiv::Graph g;
+      primitiv::Parameter pc, ph, pj;
+      Var loss, total;
+      build(g, [&]() {
+          loss = decode_segment(k, true, pc, ph, pj);
+          total = loss * scale;
+          if (k + 1 < num_segments) {
+            const Var gsum =
+              rnn_dec_->get_c() * F::input<Var>(dec_shape, gc, dev)
+              + rnn_dec_->get_h() * F::input<Var>(dec_shape, gh, dev);
+            total = total
+              + F::batch::sum(F::sum(gsum, 0))
+              + F::batch::sum(F::sum(j_ * F::input<Var>(j_shape, gj, dev), 0));
+          }
+      });
+      loss_value += g.forward(loss).to_float();
+      g.backward(total);
+      gc = pc.gradient().to_vector();
+      if (!hs[k].empty()) gh = ph.gradient().to_vector();
+      gj = pj.gradient().to_vector();
+    }
+
+    // Backward pass of the encoder.
+    {
+      const std::vector<float> genc = penc.gradient().to_vector();
+      primitiv::Graph g;
+      Var total;
+      build(g, [&]() {
+          const Var enc = F::concat(encode_states(src_batch), 1);
+          total =
+            F::batch::sum(F::sum(F::flatten(
+                    enc * F::input<Var>(enc_shape, genc, dev)), 0))
+            + F::batch::sum(F::sum(
+                  dec_c0_ * F::input<Var>(dec_shape, gc, dev), 0));
+      });
+      g.backward(total);
+    }
+
+    return loss_value;
   }
 
   // Retrieves hyperparameters.
   unsigned src_vocab_size() const { return psrc_emb_.shape()[1]; }
   unsigned trg_vocab_size() const { return ptrg_emb_.shape()[1]; }
-  unsigned embed_size() const { return rnn_fw_.input_size(); }
-  unsigned hidden_size() const { return rnn_fw_.output_size(); }
+  unsigned embed_size() const { return rnn_fw_->input_size(); }
+  unsigned hidden_size() const { return rnn_fw_->output_size(); }
+  const primitiv_nmt::proto::ModelConfig &config() const { return config_; }
+
+  // Retrieves embedding matrices. Only the columns of words in the batch
+  // receive gradients.
+  const primitiv::Parameter &src_embedding() const { return psrc_emb_; }
+  const primitiv::Parameter &trg_embedding() const { return ptrg_emb_; }
 };
 
 #endif  // PRIMITIV_NMT_ENCODER_DECODER_H_
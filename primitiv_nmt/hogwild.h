@@ -0,0 +1,298 @@
+#ifndef PRIMITIV_NMT_HOGWILD_H_
+#define PRIMITIV_NMT_HOGWILD_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include <primitiv/primitiv.h>
+
+#include <primitiv_nmt/data_parallel.h>
+#include <primitiv_nmt/sampler.h>
+
+// Hogwild!-style asynchronous training.
+// Each worker pulls its own batches from the sampler, and applies Adam updates
+// to the shared parameters without any locks. Parameters and Adam statistics
+// are kept in flat host buffers during the epoch, and are written back to the
+// master model/optimizer at the end of the epoch so that checkpoints remain
+// compatible with the synchronous trainer.
+class HogwildTrainer {
+  ::ReplicaSet &replicas_;
+  primitiv::optimizers::Adam &opt_;
+
+  // Shared state. Workers read/write these buffers concurrently without
+  // ordering, hence some updates may be lost as in Hogwild!.
+  const unsigned size_;
+  std::unique_ptr<std::atomic<float>[]> values_, m1_, m2_;
+  std::atomic<unsigned> num_steps_;
+
+  // Indices of embedding parameters whose columns are looked up sparsely,
+  // or -1 if there is no such parameter.
+  int src_emb_index_, trg_emb_index_;
+
+  // Columns of a parameter used by a batch: all columns if `all` is true,
+  // otherwise sorted `ids`.
+  struct UsedColumns {
+    bool all;
+    std::vector<unsigned> ids;
+  };
+
+  HogwildTrainer(const HogwildTrainer &) = delete;
+  HogwildTrainer &operator=(const HogwildTrainer &) = delete;
+
+  static float load(const std::atomic<float> &x) {
+    return x.load(std::memory_order_relaxed);
+  }
+
+  static void store(std::atomic<float> &x, float value) {
+    x.store(value, std::memory_order_relaxed);
+  }
+
+  // Finds columns of each parameter used by the batch, i.e., embeddings of
+  // words in the batch. Other parameters are used entirely.
+  std::vector<UsedColumns> find_used_columns(const Batch &batch) const {
+    std::vector<UsedColumns> cols(
+        replicas_.replica(0).params.size(), UsedColumns { true, {} });
+    const auto set_ids = [&](
+        int index, const std::vector<std::vector<unsigned>> &words,
+        unsigned len) {
+      if (index < 0) return;
+      std::vector<unsigned> &ids = cols[index].ids;
+      for (unsigned i = 0; i < len; ++i) {
+        ids.insert(ids.end(), words[i].begin(), words[i].end());
+      }
+      std::sort(ids.begin(), ids.end());
+      ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+      cols[index].all = false;
+    };
+    set_ids(src_emb_index_, batch.source, batch.source.size());
+    set_ids(trg_emb_index_, batch.target, batch.target.size() - 1);
+    return cols;
+  }
+
+  // Copies the used columns of the shared parameters to the replica.
+  // Other columns of the replica may be stale, but are not used.
+  void load_columns(
+      ::ReplicaSet::Replica &rep, const std::vector<UsedColumns> &cols,
+      std::vector<float> &buf) {
+    namespace F = primitiv::functions;
+    const auto &offsets = replicas_.offsets();
+    for (unsigned i = 0; i < rep.params.size(); ++i) {
+      primitiv::Parameter &param = *rep.params[i];
+      if (cols[i].all) {
+        buf.resize(offsets[i + 1] - offsets[i]);
+        for (unsigned j = 0; j < buf.size(); ++j) {
+          buf[j] = load(values_[offsets[i] + j]);
+        }
+        param.value().reset_by_vector(buf);
+        continue;
+      }
+      const std::vector<unsigned> &ids = cols[i].ids;
+      if (ids.empty()) continue;
+      const unsigned rows = param.shape()[0];
+      buf.resize(rows * ids.size());
+      for (unsigned k = 0; k < ids.size(); ++k) {
+        const unsigned begin = offsets[i] + ids[k] * rows;
+        for (unsigned j = 0; j < rows; ++j) {
+          buf[k * rows + j] = load(values_[begin + j]);
+        }
+      }
+      // Each column is a batch of picked tensors.
+      primitiv::Device &dev = param.device();
+      const primitiv::Tensor value = F::input<primitiv::Tensor>(
+          primitiv::Shape({rows}, ids.size()), buf, dev);
+      dev.pick_bw(
+          value - F::pick(param.value(), ids, 1), ids, 1, param.value());
+    }
+  }
+
+  // Retrieves gradients of the used columns of the replica into `grads`, and
+  // their ranges in the flattened parameters into `ranges`.
+  void get_gradients(
+      const ::ReplicaSet::Replica &rep, const std::vector<UsedColumns> &cols,
+      std::vector<std::pair<unsigned, unsigned>> &ranges,
+      std::vector<float> &grads) const {
+    namespace F = primitiv::functions;
+    const auto &offsets = replicas_.offsets();
+    ranges.clear();
+    grads.clear();
+    for (unsigned i = 0; i < rep.params.size(); ++i) {
+      const primitiv::Parameter &param = *rep.params[i];
+      std::vector<float> g;
+      if (cols[i].all) {
+        ranges.emplace_back(offsets[i], offsets[i + 1]);
+        g = param.gradient().to_vector();
+      } else if (!cols[i].ids.empty()) {
+        const unsigned rows = param.shape()[0];
+        for (unsigned id : cols[i].ids) {
+          const unsigned begin = offsets[i] + id * rows;
+          ranges.emplace_back(begin, begin + rows);
+        }
+        g = F::pick(param.gradient(), cols[i].ids, 1).to_vector();
+      }
+      grads.insert(grads.end(), g.begin(), g.end());
+    }
+  }
+
+  // Applies one Adam update to `ranges` of the shared parameters using
+  // `grads` retrieved by get_gradients().
+  // This function follows primitiv::optimizers::Adam, including weight decay
+  // and gradient clipping, but touches only the used columns, e.g.,
+  // embeddings of words in the batch, as LazyAdam does.
+  void update(
+      const std::vector<std::pair<unsigned, unsigned>> &ranges,
+      std::vector<float> &grads, unsigned step) {
+    const float weight_decay = opt_.get_weight_decay();
+    const float clip_threshold = opt_.get_gradient_clipping();
+
+    if (weight_decay > 0) {
+      unsigned pos = 0;
+      for (const auto &r : ranges) {
+        for (unsigned i = r.first; i < r.second; ++i) {
+          grads[pos++] += weight_decay * load(values_[i]);
+        }
+      }
+    }
+    if (clip_threshold > 0) {
+      float sq_norm = 0;
+      for (float g : grads) sq_norm += g * g;
+      if (sq_norm > clip_threshold * clip_threshold) {
+        const float clip_scale = clip_threshold / std::sqrt(sq_norm);
+        for (float &g : grads) g *= clip_scale;
+      }
+    }
+
+    const float beta1 = opt_.beta1();
+    const float beta2 = opt_.beta2();
+    const float eps = opt_.eps();
+    const float alpha = opt_.alpha() * opt_.get_learning_rate_scaling()
+      * std::sqrt(1 - std::pow(beta2, step)) / (1 - std::pow(beta1, step));
+    unsigned pos = 0;
+    for (const auto &r : ranges) {
+      for (unsigned i = r.first; i < r.second; ++i) {
+        const float g = grads[pos++];
+        const float m1 = beta1 * load(m1_[i]) + (1 - beta1) * g;
+        const float m2 = beta2 * load(m2_[i]) + (1 - beta2) * g * g;
+        store(m1_[i], m1);
+        store(m2_[i], m2);
+        store(
+            values_[i], load(values_[i]) - alpha * m1 / (std::sqrt(m2) + eps));
+      }
+    }
+  }
+
+  // Copies parameters and Adam statistics between the master model and the
+  // shared buffers.
+  void gather() {
+    const auto &params = replicas_.replica(0).params;
+    const auto &offsets = replicas_.offsets();
+    for (unsigned i = 0; i < params.size(); ++i) {
+      const std::vector<float> value = params[i]->value().to_vector();
+      const std::vector<float> m1 = params[i]->stats("adam-m1").to_vector();
+      const std::vector<float> m2 = params[i]->stats("adam-m2").to_vector();
+      for (unsigned j = 0; j < value.size(); ++j) {
+        store(values_[offsets[i] + j], value[j]);
+        store(m1_[offsets[i] + j], m1[j]);
+        store(m2_[offsets[i] + j], m2[j]);
+      }
+    }
+  }
+
+  void scatter() {
+    const auto &params = replicas_.replica(0).params;
+    const auto &offsets = replicas_.offsets();
+    std::vector<float> value, m1, m2;
+    for (unsigned i = 0; i < params.size(); ++i) {
+      const unsigned size = offsets[i + 1] - offsets[i];
+      value.resize(size);
+      m1.resize(size);
+      m2.resize(size);
+      for (unsigned j = 0; j < size; ++j) {
+        value[j] = load(values_[offsets[i] + j]);
+        m1[j] = load(m1_[offsets[i] + j]);
+        m2[j] = load(m2_[offsets[i] + j]);
+      }
+      params[i]->value().reset_by_vector(value);
+      params[i]->stats("adam-m1").reset_by_vector(m1);
+      params[i]->stats("adam-m2").reset_by_vector(m2);
+    }
+  }
+
+public:
+  HogwildTrainer(::ReplicaSet &replicas, primitiv::Optimizer &opt)
+    : replicas_(replicas)
+    , opt_(dynamic_cast<primitiv::optimizers::Adam &>(opt))
+    , size_(replicas.offsets().back())
+    , values_(new std::atomic<float>[size_])
+    , m1_(new std::atomic<float>[size_])
+    , m2_(new std::atomic<float>[size_])
+    , num_steps_(0)
+    , src_emb_index_(-1)
+    , trg_emb_index_(-1) {
+    const ::ReplicaSet::Replica &master = replicas_.replica(0);
+    for (unsigned i = 0; i < master.params.size(); ++i) {
+      if (master.params[i] == &master.model->src_embedding()) {
+        src_emb_index_ = i;
+      }
+      // The tied embedding also receives gradients from the output layer.
+      if (master.params[i] == &master.model->trg_embedding()
+          && !master.model->config().tie_target_embedding()) {
+        trg_emb_index_ = i;
+      }
+    }
+  }
+
+  // Trains the model through all batches of the sampler.
+  // Returns the loss summed over all sentences, and the number of sentences
+  // and labels processed.
+  float process(
+      ::Sampler &sampler, unsigned &num_sents, unsigned &num_labels) {
+    const unsigned total_sents = sampler.num_sentences();
+    const unsigned first_step = opt_.get_epoch();
+    std::mutex sampler_mutex;
+    float accum_loss = 0;
+    num_sents = 0;
+    num_labels = 0;
+    num_steps_ = 0;
+    gather();
+
+    ::parallel_for(replicas_.size(), [&](unsigned i) {
+        ::ReplicaSet::Replica &rep = replicas_.replica(i);
+        std::vector<std::pair<unsigned, unsigned>> ranges;
+        std::vector<float> buf, grads;
+        while (true) {
+          Batch batch;
+          {
+            std::lock_guard<std::mutex> lock(sampler_mutex);
+            if (!sampler.has_next()) break;
+            batch = sampler.next();
+          }
+          const std::vector<UsedColumns> cols = find_used_columns(batch);
+          load_columns(rep, cols, buf);
+          const float loss = replicas_.backward(i, batch, 1);
+          get_gradients(rep, cols, ranges, grads);
+          update(ranges, grads, first_step + ++num_steps_);
+
+          std::lock_guard<std::mutex> lock(sampler_mutex);
+          const unsigned batch_size = batch.source[0].size();
+          accum_loss += loss;
+          num_sents += batch_size;
+          num_labels += batch_size * (batch.target.size() - 1);
+          std::cout << num_sents << '/' << total_sents << '\r' << std::flush;
+        }
+    });
+
+    replicas_.restore_default_device();
+    scatter();
+    opt_.set_epoch(first_step + num_steps_);
+    return accum_loss;
+  }
+};
+
+#endif  // PRIMITIV_NMT_HOGWILD_H_
@@ -0,0 +1,146 @@
+#ifndef PRIMITIV_NMT_LAZY_ADAM_H_
+#define PRIMITIV_NMT_LAZY_ADAM_H_
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <primitiv/primitiv.h>
+
+// Adam which updates only the columns with non-zero gradients of sparse
+// parameters, e.g., embeddings looked up by F::pick().
+// Moments and weight decay of other columns are left untouched until the
+// column is used again. Statistics are stored with the same names as
+// primitiv::optimizers::Adam, so saved files are compatible with each other.
+class LazyAdam : public primitiv::optimizers::Adam {
+  std::unordered_map<const primitiv::Parameter *, std::vector<unsigned>>
+    columns_;
+  std::vector<primitiv::Parameter *> params_;
+
+  LazyAdam(const LazyAdam &) = delete;
+  LazyAdam &operator=(const LazyAdam &) = delete;
+
+  // Retrieves the gradient of the parameter, or only the used columns of
+  // sparse parameters.
+  primitiv::Tensor get_gradient(const primitiv::Parameter &param) const {
+    const auto it = columns_.find(&param);
+    if (it == columns_.end()) return param.gradient();
+    return primitiv::functions::pick(param.gradient(), it->second, 1);
+  }
+
+  void configure_parameter(primitiv::Parameter &param) override {
+    for (const char *name : {"adam-m1", "adam-m2"}) {
+      if (!param.has_stats(name)) {
+        param.add_stats(name, param.shape());
+        param.stats(name).reset(0);
+      }
+    }
+    params_.emplace_back(&param);
+  }
+
+  // Weight decay and gradient clipping are already applied by update().
+  void update_parameter(float scale, primitiv::Parameter &param) override {
+    update_columns(scale, param, 0, 1);
+  }
+
+  // Updates the parameter, or only the declared columns of sparse parameters,
+  // applying weight decay and scaling of gradients.
+  void update_columns(
+      float scale, primitiv::Parameter &param,
+      float weight_decay, float clip_scale) {
+    namespace F = primitiv::functions;
+    const float e = get_epoch() + 1;
+    const float b1 = beta1();
+    const float b2 = beta2();
+    const float step_size = scale * alpha()
+      * std::sqrt(1 - std::pow(b2, e)) / (1 - std::pow(b1, e));
+    primitiv::Tensor &m1 = param.stats("adam-m1");
+    primitiv::Tensor &m2 = param.stats("adam-m2");
+
+    const auto it = columns_.find(&param);
+    if (it == columns_.end()) {
+      primitiv::Tensor g = param.gradient();
+      if (weight_decay > 0) g = g + weight_decay * param.value();
+      if (clip_scale != 1) g = clip_scale * g;
+      m1 = b1 * m1 + (1 - b1) * g;
+      m2 = b2 * m2 + (1 - b2) * g * g;
+      param.value() -= step_size * m1 / (F::sqrt(m2) + eps());
+      return;
+    }
+
+    // Each column is a batch of picked tensors.
+    const std::vector<unsigned> &cols = it->second;
+    if (cols.empty()) return;
+    primitiv::Device &dev = param.device();
+    primitiv::Tensor g = F::pick(param.gradient(), cols, 1);
+    if (weight_decay > 0) {
+      g = g + weight_decay * F::pick(param.value(), cols, 1);
+    }
+    if (clip_scale != 1) g = clip_scale * g;
+    const primitiv::Tensor m1_old = F::pick(m1, cols, 1);
+    const primitiv::Tensor m2_old = F::pick(m2, cols, 1);
+    const primitiv::Tensor m1_new = b1 * m1_old + (1 - b1) * g;
+    const primitiv::Tensor m2_new = b2 * m2_old + (1 - b2) * g * g;
+    dev.pick_bw(m1_new - m1_old, cols, 1, m1);
+    dev.pick_bw(m2_new - m2_old, cols, 1, m2);
+    dev.pick_bw(
+        -step_size * m1_new / (F::sqrt(m2_new) + eps()),
+        cols, 1, param.value());
+  }
+
+public:
+  explicit LazyAdam(
+      float alpha = 0.001, float beta1 = 0.9, float beta2 = 0.999,
+      float eps = 1e-8)
+    : primitiv::optimizers::Adam(alpha, beta1, beta2, eps) {}
+
+  // Declares that only `columns` of the parameter have non-zero gradients in
+  // the next lazy_update(). The parameter should be a matrix.
+  void set_sparse_columns(
+      const primitiv::Parameter &param, std::vector<unsigned> columns) {
+    std::sort(columns.begin(), columns.end());
+    columns.erase(std::unique(columns.begin(), columns.end()), columns.end());
+    columns_[&param] = std::move(columns);
+  }
+
+  // Updates all parameters, touching only declared columns of sparse
+  // parameters. Weight decay and gradient clipping are also calculated only
+  // over these columns. Declarations are cleared after the update.
+  // update() of the base class can still be used, which applies weight decay
+  // and gradient clipping to all columns before the lazy updates.
+  void lazy_update() {
+    namespace F = primitiv::functions;
+    const float weight_decay = get_weight_decay();
+    const float clip_threshold = get_gradient_clipping();
+
+    float clip_scale = 1;
+    if (clip_threshold > 0 && !params_.empty()) {
+      // Squared norms are summed on the device to synchronize only once.
+      std::vector<primitiv::Tensor> sq_norms;
+      for (const primitiv::Parameter *param : params_) {
+        primitiv::Tensor g = get_gradient(*param);
+        if (weight_decay > 0) {
+          const auto it = columns_.find(param);
+          g = g + weight_decay * (it == columns_.end()
+              ? param->value() : F::pick(param->value(), it->second, 1));
+        }
+        sq_norms.emplace_back(F::batch::sum(F::sum(F::flatten(g * g), 0)));
+      }
+      const float sq_norm = F::sum(sq_norms).to_float();
+      if (sq_norm > clip_threshold * clip_threshold) {
+        clip_scale = clip_threshold / std::sqrt(sq_norm);
+      }
+    }
+
+    const float scale = get_learning_rate_scaling();
+    for (primitiv::Parameter *param : params_) {
+      update_columns(scale, *param, weight_decay, clip_scale);
+    }
+    set_epoch(get_epoch() + 1);
+    columns_.clear();
+  }
+};
+
+#endif  // PRIMITIV_NMT_LAZY_ADAM_H_
@@ -0,0 +1,63 @@
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+
+#include <primitiv_nmt/bpe.h>
+#include <primitiv_nmt/primitiv_nmt.pb.h>
+#include <primitiv_nmt/utils.h>
+
+using namespace std;
+
+void learn_bpe(
+    unsigned num_merges, unsigned min_freq,
+    const string &corpus_file, const string &bpe_file) {
+  cout << "Corpus: " << corpus_file << endl;
+  cout << "#merges: " << num_merges << endl;
+
+  ifstream ifs;
+  ::open_file(corpus_file, ifs);
+
+  // Counting
+  unordered_map<string, unsigned> freq;
+  string line;
+  unsigned num_sents = 0;
+  while (getline(ifs, line)) {
+    for (const auto &w : ::split(line)) {
+      if (!::is_special_word(w)) ++freq[w];
+    }
+    ++num_sents;
+    if (num_sents % 10000 == 0) cout << num_sents << '\r' << flush;
+  }
+
+  cout << "#sentences: " << num_sents << endl;
+  cout << "#word types: " << freq.size() << endl;
+
+  const primitiv_nmt::proto::BPEModel bpe = ::learn_bpe(
+      freq, num_merges, min_freq);
+  cout << "#learned merges: " << bpe.merges_size() << endl;
+
+  ::save_proto(bpe_file, bpe);
+  cout << "Saved BPE model to: " << bpe_file << endl;
+}
+
+int main(int argc, char *argv[]) {
+  const auto opts = ::check_args(argc, argv, {
+      "(int) Number of merge operations",
+      "(file/in) Corpus text file",
+      "(file/out) BPE model file",
+  }, {
+      {"min-frequency", "2", "(int) Minimum frequency of merged pairs"},
+  });
+
+  ::global_try_block([&]() {
+      const unsigned num_merges = stoi(argv[1]);
+      const string corpus_file = argv[2];
+      const string bpe_file = argv[3];
+      const unsigned min_freq = stoi(opts.at("min-frequency"));
+      ::learn_bpe(num_merges, min_freq, corpus_file, bpe_file);
+  });
+
+  return 0;
+}
@@ -3,10 +3,13 @@
 
 #include <cmath>
 #include <fstream>
+#include <memory>
 #include <string>
 
 #include <primitiv/primitiv.h>
 
+#include <primitiv_nmt/recurrent_cell.h>
+#include <primitiv_nmt/sparse.h>
 #include <primitiv_nmt/utils.h>
 
 // Hand-written LSTM with input/forget/output gates and no peepholes.
@@ -18,20 +21,21 @@
 //   c[t] = i * j + f * c[t-1]
 //   h[t] = o * tanh(c[t])
 template<typename Var>
-class LSTM : public primitiv::Model {
+class LSTM : public ::RecurrentCell<Var> {
   primitiv::Parameter pwxh_, pwhh_, pbh_;
   Var wxh_, whh_, bh_, h_, c_;
+  std::shared_ptr<::BlockSparseMatrix> swxh_, swhh_;
 
 public:
   // New model.
   LSTM() {
-    add("wxh", pwxh_);
-    add("whh", pwhh_);
-    add("bh", pbh_);
+    this->add("wxh", pwxh_);
+    this->add("whh", pwhh_);
+    this->add("bh", pbh_);
   }
 
   // Initializes parameters.
-  void init(unsigned input_size, unsigned output_size) {
+  void init(unsigned input_size, unsigned output_size) override {
     namespace I = primitiv::initializers;
     pwxh_.init({4 * output_size, input_size}, I::Uniform(-0.1, 0.1));
     pwhh_.init({4 * output_size, output_size}, I::Uniform(-0.1, 0.1));
@@ -39,20 +43,26 @@ public:
   }
 
   // Initializes internal values.
-  void reset(const Var &init_c, const Var &init_h) {
+  void reset(const Var &init_c, const Var &init_h) override {
     namespace F = primitiv::functions;
     wxh_ = F::parameter<Var>(pwxh_);
     whh_ = F::parameter<Var>(pwhh_);
     bh_ = F::parameter<Var>(pbh_);
-    c_ = init_c.valid() ? init_c : F::zeros<Var>({output_size()});
+    c_ = init_c.valid()
+      ? init_c : F::zeros<Var>({output_size()}, pbh_.device());
     h_ = init_h.valid() ? init_h : F::tanh(c_);
   }
 
   // One step forwarding.
-  Var forward(const Var &x) {
+  Var forward(const Var &x) override {
+    return forward_projected(project(x) + bh_);
+  }
+
+  // One step forwarding with precomputed W_x . x[t] + b.
+  Var forward_projected(const Var &wxb) override {
     namespace F = primitiv::functions;
     const unsigned no = output_size();
-    const Var u = F::matmul(wxh_, x) + F::matmul(whh_, h_) + bh_;
+    const Var u = wxb + ::sparse_matmul(whh_, swhh_.get(), h_);
     const Var i = F::sigmoid(F::slice(u, 0, 0, no));
     const Var f = F::sigmoid(1 + F::slice(u, 0, no, 2 * no));
     const Var o = F::sigmoid(F::slice(u, 0, 2 * no, 3 * no));
@@ -62,13 +72,31 @@ public:
     return h_;
   }
 
+  // Retrieves columns [lower, upper) of W_x and the bias, which can be used to
+  // precompute inputs of forward_projected().
+  Var get_wx(unsigned lower, unsigned upper) override {
+    namespace F = primitiv::functions;
+    return F::slice(F::parameter<Var>(pwxh_), 1, lower, upper);
+  }
+  Var get_b() override { return primitiv::functions::parameter<Var>(pbh_); }
+
+  Var project(const Var &xs) override {
+    return ::sparse_matmul(wxh_, swxh_.get(), xs);
+  }
+
+  void make_sparse(
+      float min_sparsity, unsigned block_rows, unsigned block_cols) override {
+    swxh_ = ::make_sparse_matrix(pwxh_, min_sparsity, block_rows, block_cols);
+    swhh_ = ::make_sparse_matrix(pwhh_, min_sparsity, block_rows, block_cols);
+  }
+
   // Retrieves current states.
-  Var get_c() const { return c_; }
-  Var get_h() const { return h_; }
+  Var get_c() const override { return c_; }
+  Var get_h() const override { return h_; }
 
   // Retrieves hyperparameters.
-  unsigned input_size() const { return pwxh_.shape()[1]; }
-  unsigned output_size() const { return pwxh_.shape()[0] / 4; }
+  unsigned input_size() const override { return pwxh_.shape()[1]; }
+  unsigned output_size() const override { return pwxh_.shape()[0] / 4; }
 };
 
 #endif  // PRIMITIV_NMT_LSTM_H_
@@ -1,8 +1,10 @@
 #include <cstdlib>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include <primitiv_nmt/bpe.h>
 #include <primitiv_nmt/primitiv_nmt.pb.h>
 #include <primitiv_nmt/utils.h>
 #include <primitiv_nmt/vocabulary.h>
@@ -13,6 +15,7 @@ void make_corpus(
     unsigned min_words, unsigned max_words,
     const string &src_corpus_path, const string &trg_corpus_path,
     const ::Vocabulary &src_vocab, const ::Vocabulary &trg_vocab,
+    const ::BPE *src_bpe, const ::BPE *trg_bpe, unsigned num_threads,
     const string &out_path) {
   ifstream src_ifs, trg_ifs;
   ::open_file(src_corpus_path, src_ifs);
@@ -20,29 +23,36 @@ void make_corpus(
 
   primitiv_nmt::proto::Corpus corpus;
 
-  string src_line, trg_line;
+  vector<string> src_lines, trg_lines;
+  vector<::BPECache> src_caches(num_threads), trg_caches(num_threads);
   unsigned stored = 0, ignored = 0;
-  while(getline(src_ifs, src_line) && getline(trg_ifs, trg_line)) {
-    const vector<unsigned> src_ids = src_vocab.line_to_ids(
-        "<bos> " + src_line + " <eos>");
-    const vector<unsigned> trg_ids = trg_vocab.line_to_ids(
-        "<bos> " + trg_line + " <eos>");
-    const unsigned src_size = src_ids.size() - 2;
-    const unsigned trg_size = trg_ids.size() - 2;
-    if (src_size >= min_words && src_size <= max_words &&
-        trg_size >= min_words && trg_size <= max_words) {
-      primitiv_nmt::proto::Sample *sample = corpus.add_samples();
-      primitiv_nmt::proto::Sentence *source = sample->mutable_source();
-      for (const unsigned src_id : src_ids) source->add_token_ids(src_id);
-      primitiv_nmt::proto::Sentence *target = sample->mutable_target();
-      for (const unsigned trg_id : trg_ids) target->add_token_ids(trg_id);
-      ++stored;
-    } else {
-      ++ignored;
-    }
-    if ((stored + ignored) % 10000 == 0) {
-      cout << (stored + ignored) << '\r' << flush;
+  while (::read_lines(src_ifs, 10000, src_lines)
+      && ::read_lines(trg_ifs, 10000, trg_lines)) {
+    const unsigned num_lines = min(src_lines.size(), trg_lines.size());
+    if (src_bpe) src_bpe->encode_lines(src_lines, src_caches, num_threads);
+    if (trg_bpe) trg_bpe->encode_lines(trg_lines, trg_caches, num_threads);
+    for (unsigned i = 0; i < num_lines; ++i) {
+      const string &src_line = src_lines[i];
+      const string &trg_line = trg_lines[i];
+      const vector<unsigned> src_ids = src_vocab.line_to_ids(
+          "<bos> " + src_line + " <eos>");
+      const vector<unsigned> trg_ids = trg_vocab.line_to_ids(
+          "<bos> " + trg_line + " <eos>");
+      const unsigned src_size = src_ids.size() - 2;
+      const unsigned trg_size = trg_ids.size() - 2;
+      if (src_size >= min_words && src_size <= max_words &&
+          trg_size >= min_words && trg_size <= max_words) {
+        primitiv_nmt::proto::Sample *sample = corpus.add_samples();
+        primitiv_nmt::proto::Sentence *source = sample->mutable_source();
+        for (const unsigned src_id : src_ids) source->add_token_ids(src_id);
+        primitiv_nmt::proto::Sentence *target = sample->mutable_target();
+        for (const unsigned trg_id : trg_ids) target->add_token_ids(trg_id);
+        ++stored;
+      } else {
+        ++ignored;
+      }
     }
+    cout << (stored + ignored) << '\r' << flush;
   }
 
   cout << "#stored sentences: " << stored << endl;
@@ -53,7 +63,7 @@ void make_corpus(
 }
 
 int main(int argc, char *argv[]) {
-  ::check_args(argc, argv, {
+  const auto opts = ::check_args(argc, argv, {
       "(int) Minimum #words/sentence",
       "(int) Maximum #words/sentence",
       "(file/in) Source corpus",
@@ -61,6 +71,10 @@ int main(int argc, char *argv[]) {
       "(file/in) Source vocabulary",
       "(file/in) Target vocabulary",
       "(file/out) Corpus file",
+  }, {
+      {"src-bpe", "", "(file/in) BPE model file applied to the source corpus"},
+      {"trg-bpe", "", "(file/in) BPE model file applied to the target corpus"},
+      {"threads", "0", "(int) Number of threads to apply BPE (0: all cores)"},
   });
 
   ::global_try_block([&]() {
@@ -71,9 +85,16 @@ int main(int argc, char *argv[]) {
       const ::Vocabulary src_vocab(*++argv);
       const ::Vocabulary trg_vocab(*++argv);
       const string out_path = *++argv;
+      const string src_bpe_path = opts.at("src-bpe");
+      const string trg_bpe_path = opts.at("trg-bpe");
+      unique_ptr<::BPE> src_bpe, trg_bpe;
+      if (!src_bpe_path.empty()) src_bpe.reset(new ::BPE(src_bpe_path));
+      if (!trg_bpe_path.empty()) trg_bpe.reset(new ::BPE(trg_bpe_path));
+      const unsigned num_threads = ::get_num_threads(stoi(opts.at("threads")));
       ::make_corpus(
           min_words, max_words, src_corpus_path, trg_corpus_path,
-          src_vocab, trg_vocab, out_path);
+          src_vocab, trg_vocab, src_bpe.get(), trg_bpe.get(), num_threads,
+          out_path);
   });
 
   return 0;
@@ -0,0 +1,95 @@
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <primitiv_nmt/primitiv_nmt.pb.h>
+#include <primitiv_nmt/utils.h>
+#include <primitiv_nmt/vocabulary.h>
+
+using namespace std;
+
+// Makes translation candidates of each source word, ranked by the Dice
+// coefficient of sentence-level co-occurrences.
+void make_shortlist(
+    unsigned num_candidates, unsigned min_count,
+    const primitiv_nmt::proto::Corpus &corpus,
+    const ::Vocabulary &src_vocab, const ::Vocabulary &trg_vocab,
+    const string &out_path) {
+  cout << "#candidates/word: " << num_candidates << endl;
+
+  // Counting
+  vector<unsigned> src_count(src_vocab.size()), trg_count(trg_vocab.size());
+  vector<unordered_map<unsigned, unsigned>> pair_count(src_vocab.size());
+  const unsigned num_sents = corpus.samples_size();
+  for (unsigned i = 0; i < num_sents; ++i) {
+    const auto &sample = corpus.samples(i);
+    vector<unsigned> src_ids(
+        sample.source().token_ids().begin(),
+        sample.source().token_ids().end());
+    vector<unsigned> trg_ids(
+        sample.target().token_ids().begin(),
+        sample.target().token_ids().end());
+    sort(src_ids.begin(), src_ids.end());
+    src_ids.erase(unique(src_ids.begin(), src_ids.end()), src_ids.end());
+    sort(trg_ids.begin(), trg_ids.end());
+    trg_ids.erase(unique(trg_ids.begin(), trg_ids.end()), trg_ids.end());
+    for (const unsigned s : src_ids) {
+      ++src_count[s];
+      for (const unsigned t : trg_ids) ++pair_count[s][t];
+    }
+    for (const unsigned t : trg_ids) ++trg_count[t];
+    if ((i + 1) % 10000 == 0) cout << (i + 1) << '\r' << flush;
+  }
+  cout << "#sentences: " << num_sents << endl;
+
+  // Chooses candidates.
+  primitiv_nmt::proto::Shortlist shortlist;
+  unsigned num_total = 0;
+  for (unsigned s = 0; s < src_vocab.size(); ++s) {
+    vector<pair<float, unsigned>> scores;
+    for (const auto &kv : pair_count[s]) {
+      if (kv.second < min_count) continue;
+      const float dice = 2.f * kv.second / (src_count[s] + trg_count[kv.first]);
+      scores.emplace_back(-dice, kv.first);
+    }
+    const unsigned n = min<unsigned>(num_candidates, scores.size());
+    partial_sort(scores.begin(), scores.begin() + n, scores.end());
+    primitiv_nmt::proto::ShortlistEntry *entry = shortlist.add_entries();
+    for (unsigned i = 0; i < n; ++i) entry->add_token_ids(scores[i].second);
+    num_total += n;
+  }
+  cout << "#total candidates: " << num_total << endl;
+
+  ::save_proto(out_path, shortlist);
+  cout << "Shortlist saved to: " << out_path << endl;
+}
+
+int main(int argc, char *argv[]) {
+  const auto opts = ::check_args(argc, argv, {
+      "(file/in) Corpus file",
+      "(file/in) Source vocabulary file",
+      "(file/in) Target vocabulary file",
+      "(file/out) Shortlist file",
+  }, {
+      {"candidates", "50", "(int) Number of candidates for each source word"},
+      {"min-count", "2", "(int) Minimum co-occurrence count of candidates"},
+  });
+
+  ::global_try_block([&]() {
+      primitiv_nmt::proto::Corpus corpus;
+      ::load_proto(*++argv, corpus);
+      const ::Vocabulary src_vocab(*++argv);
+      const ::Vocabulary trg_vocab(*++argv);
+      const string out_path = *++argv;
+      const unsigned num_candidates = stoi(opts.at("candidates"));
+      const unsigned min_count = stoi(opts.at("min-count"));
+      ::make_shortlist(
+          num_candidates, min_count, corpus, src_vocab, trg_vocab, out_path);
+  });
+
+  return 0;
+}
@@ -0,0 +1,101 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <primitiv_nmt/utils.h>
+
+using namespace std;
+
+// Draws word ranks [0, vocab_size) from the Zipf distribution
+// P(r) ~ 1 / (r + 1)^exponent.
+discrete_distribution<unsigned> make_zipf(unsigned vocab_size, float exponent) {
+  vector<double> weights(vocab_size);
+  for (unsigned i = 0; i < vocab_size; ++i) {
+    weights[i] = 1. / pow(i + 1., exponent);
+  }
+  return discrete_distribution<unsigned>(weights.begin(), weights.end());
+}
+
+// Draws a length from the normal distribution clipped to [min_len, max_len].
+unsigned draw_length(
+    double mean, double stddev, unsigned min_len, unsigned max_len,
+    mt19937 &rng) {
+  const double len = normal_distribution<double>(mean, stddev)(rng);
+  return max<double>(min_len, min<double>(max_len, round(len)));
+}
+
+// Writes a sentence of random words "<prefix><rank>".
+void write_sentence(
+    const string &prefix, unsigned len, discrete_distribution<unsigned> &zipf,
+    mt19937 &rng, ofstream &ofs) {
+  for (unsigned i = 0; i < len; ++i) {
+    ofs << (i > 0 ? " " : "") << prefix << zipf(rng);
+  }
+  ofs << '\n';
+}
+
+// Generates a random parallel corpus whose word frequencies follow the Zipf's
+// law, e.g., to measure the performance at various scales without external
+// data. Target lengths are proportional to source lengths with some noise.
+int main(int argc, char *argv[]) {
+  const auto opts = ::check_args(argc, argv, {
+      "(int) Number of sentences",
+      "(int) Number of distinct words",
+      "(file/out) Source corpus",
+      "(file/out) Target corpus",
+  }, {
+      {"trg-words", "",
+        "(int) Number of distinct target words (empty: same as source)"},
+      {"zipf", "1.0", "(float) Exponent of the Zipf distribution of words"},
+      {"length", "20", "(float) Mean number of source words per sentence"},
+      {"length-stddev", "8", "(float) Stddev of source lengths"},
+      {"min-length", "1", "(int) Minimum #words/sentence"},
+      {"max-length", "80", "(int) Maximum #words/sentence"},
+      {"length-ratio", "1.0", "(float) Mean ratio of target/source lengths"},
+      {"seed", "0", "(int) Random seed"},
+  });
+
+  ::global_try_block([&]() {
+      const unsigned num_sents = stoi(*++argv);
+      const unsigned src_words = stoi(*++argv);
+      const string src_file = *++argv;
+      const string trg_file = *++argv;
+      const unsigned trg_words = opts.at("trg-words").empty()
+        ? src_words : stoi(opts.at("trg-words"));
+      const float exponent = stof(opts.at("zipf"));
+      const float mean_len = stof(opts.at("length"));
+      const float stddev = stof(opts.at("length-stddev"));
+      const unsigned min_len = stoi(opts.at("min-length"));
+      const unsigned max_len = stoi(opts.at("max-length"));
+      const float ratio = stof(opts.at("length-ratio"));
+      if (src_words == 0 || trg_words == 0) {
+        throw runtime_error("Number of words should be >= 1.");
+      }
+      if (min_len == 0 || min_len > max_len) {
+        throw runtime_error("Invalid range of lengths.");
+      }
+
+      mt19937 rng(stoi(opts.at("seed")));
+      auto src_zipf = ::make_zipf(src_words, exponent);
+      auto trg_zipf = ::make_zipf(trg_words, exponent);
+      ofstream src_ofs, trg_ofs;
+      ::open_file(src_file, src_ofs);
+      ::open_file(trg_file, trg_ofs);
+
+      for (unsigned i = 0; i < num_sents; ++i) {
+        const unsigned src_len =
+          ::draw_length(mean_len, stddev, min_len, max_len, rng);
+        const unsigned trg_len = ::draw_length(
+            ratio * src_len, 0.1 * src_len + 1, min_len, max_len, rng);
+        ::write_sentence("s", src_len, src_zipf, rng, src_ofs);
+        ::write_sentence("t", trg_len, trg_zipf, rng, trg_ofs);
+      }
+      cout << "Generated " << num_sents << " sentences." << endl;
+  });
+
+  return 0;
+}
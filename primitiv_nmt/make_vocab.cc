@@ -1,11 +1,14 @@
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <queue>
 #include <stdexcept>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
+#include <primitiv_nmt/bpe.h>
 #include <primitiv_nmt/primitiv_nmt.pb.h>
 #include <primitiv_nmt/utils.h>
 
@@ -14,7 +17,9 @@ using namespace std;
 void make_vocab(
     const unsigned vocab_size,
     const string &corpus_file,
-    const string &vocab_file) {
+    const string &vocab_file,
+    const string &bpe_file,
+    unsigned num_threads) {
   if (vocab_size < 3) {
     throw std::runtime_error("Vocabulary size should be >= 3.");
   }
@@ -25,21 +30,32 @@ void make_vocab(
   ifstream ifs;
   ::open_file(corpus_file, ifs);
 
+  // Words are counted after applying BPE if given.
+  unique_ptr<::BPE> bpe;
+  if (!bpe_file.empty()) {
+    cout << "BPE model: " << bpe_file << endl;
+    bpe.reset(new ::BPE(bpe_file));
+  }
+  vector<::BPECache> caches(num_threads);
+
   // Counting
   unordered_map<string, unsigned> freq;
-  string line;
+  vector<string> lines;
   unsigned num_all = 0, num_unk = 0;
   unsigned num_sents = 0;
-  while (getline(ifs, line)) {
-    for (const auto &w : ::split(line)) {
-      ++num_all;
-      if (w == "<bos>") throw runtime_error("Corpus has '<bos>' word.");
-      else if (w == "<eos>") throw runtime_error("Corpus has '<eos>' word.");
-      else if (w == "<unk>") ++num_unk;
-      else ++freq[w];
+  while (::read_lines(ifs, 10000, lines)) {
+    if (bpe) bpe->encode_lines(lines, caches, num_threads);
+    for (const string &line : lines) {
+      for (const auto &w : ::split(line)) {
+        ++num_all;
+        if (w == "<bos>") throw runtime_error("Corpus has '<bos>' word.");
+        else if (w == "<eos>") throw runtime_error("Corpus has '<eos>' word.");
+        else if (w == "<unk>") ++num_unk;
+        else ++freq[w];
+      }
     }
-    ++num_sents;
-    if (num_sents % 10000 == 0) cout << num_sents << '\r' << flush;
+    num_sents += lines.size();
+    cout << num_sents << '\r' << flush;
   }
 
   cout << "#sentences: " << num_sents << endl;
@@ -83,17 +99,22 @@ void make_vocab(
 }
 
 int main(int argc, char *argv[]) {
-  ::check_args(argc, argv, {
+  const auto opts = ::check_args(argc, argv, {
       "(int) Vocabulary size",
       "(file/in) Corpus text file",
       "(file/out) Vocabulary file",
+  }, {
+      {"bpe", "", "(file/in) BPE model file applied to the corpus"},
+      {"threads", "0", "(int) Number of threads to apply BPE (0: all cores)"},
   });
 
   ::global_try_block([&]() {
       const unsigned vocab_size = stoi(argv[1]);
       const string corpus_file = argv[2];
       const string vocab_file = argv[3];
-      ::make_vocab(vocab_size, corpus_file, vocab_file);
+      const string bpe_file = opts.at("bpe");
+      const unsigned num_threads = ::get_num_threads(stoi(opts.at("threads")));
+      ::make_vocab(vocab_size, corpus_file, vocab_file, bpe_file, num_threads);
   });
 
   return 0;
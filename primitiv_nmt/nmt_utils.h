@@ -1,14 +1,28 @@
 #ifndef PRIMITIV_NMT_NMT_UTILS_H_
 #define PRIMITIV_NMT_NMT_UTILS_H_
 
+#include <algorithm>
+#include <functional>
+#include <future>
+#include <numeric>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <primitiv/primitiv.h>
 
+#include <primitiv_nmt/checkpoint.h>
+#include <primitiv_nmt/compressed_model.h>
+#include <primitiv_nmt/cpu_affinity.h>
+#include <primitiv_nmt/data_parallel.h>
+#include <primitiv_nmt/distributed.h>
 #include <primitiv_nmt/encoder_decoder.h>
+#include <primitiv_nmt/hogwild.h>
+#include <primitiv_nmt/lazy_adam.h>
+#include <primitiv_nmt/sampled_softmax.h>
 #include <primitiv_nmt/sampler.h>
 #include <primitiv_nmt/utils.h>
 #include <primitiv_nmt/vocabulary.h>
@@ -18,12 +32,14 @@ struct Result {
   std::vector<std::vector<float>> atten_probs;
 };
 
+// Greedily decodes a sentence. Attention probabilities are copied to the
+// host memory only if `with_atten` is true.
 template<typename Var>
 inline ::Result infer_sentence(
     ::EncoderDecoder<Var> &model,
     unsigned bos_id, unsigned eos_id,
     const std::vector<std::vector<unsigned>> &src_batch,
-    unsigned limit) {
+    unsigned limit, bool with_atten = false) {
   namespace F = primitiv::functions;
 
   // Initialize the model
@@ -36,10 +52,9 @@ inline ::Result infer_sentence(
   while (ret.word_ids.back() != eos_id) {
     const std::vector<unsigned> prev {ret.word_ids.back()};
     const auto a_probs = model.decode_atten(prev);
-    ret.atten_probs.emplace_back(a_probs.to_vector());
+    if (with_atten) ret.atten_probs.emplace_back(a_probs.to_vector());
 
-    const auto scores = model.decode_word(a_probs);
-    ret.word_ids.emplace_back(::argmax(scores.to_vector()));
+    ret.word_ids.emplace_back(model.decode_greedy(a_probs)[0]);
 
     if (ret.word_ids.size() == limit + 1) {
       ret.word_ids.emplace_back(eos_id);
@@ -50,44 +65,63 @@ inline ::Result infer_sentence(
   return ret;
 }
 
+// Greedily decodes a sentence using the sum of log probabilities of all
+// models. Mean attention probabilities are calculated only if `with_atten` is
+// true. If `workers` is given, the i-th model runs on the i-th worker thread
+// concurrently.
 template<typename Var>
 inline ::Result infer_sentence_ensemble(
     std::vector<std::unique_ptr<primitiv::Device>> &devs,
     std::vector<std::unique_ptr<::EncoderDecoder<Var>>> &models,
     unsigned bos_id, unsigned eos_id,
     const std::vector<std::vector<unsigned>> &src_batch,
-    unsigned limit) {
+    unsigned limit, bool with_atten = false,
+    ::PinnedWorkers *workers = nullptr) {
   namespace F = primitiv::functions;
 
+  const auto for_each_model = [&](const std::function<void(unsigned)> &fn) {
+    if (workers) {
+      workers->run(fn);
+      return;
+    }
+    for (unsigned i = 0; i < models.size(); ++i) {
+      primitiv::Device::set_default(*devs[i % devs.size()]);
+      fn(i);
+    }
+  };
+
   // Initialize the model
-  for (unsigned i = 0; i < models.size(); ++i) {
-    primitiv::Device::set_default(*devs[i % devs.size()]);
-    models[i]->encode(src_batch);
-    models[i]->init_decoder();
-  }
+  for_each_model([&](unsigned i) {
+      models[i]->encode(src_batch);
+      models[i]->init_decoder();
+  });
 
   ::Result ret { {bos_id}, {} };
 
   // Decode
   while (ret.word_ids.back() != eos_id) {
-    std::vector<Var> a_probs_list;
-    std::vector<Var> scores_list;
+    std::vector<Var> a_probs_list(models.size());
+    std::vector<Var> scores_list(models.size());
     const std::vector<unsigned> prev {ret.word_ids.back()};
 
-    for (unsigned i = 0; i < models.size(); ++i) {
-      primitiv::Device::set_default(*devs[i % devs.size()]);
-      const auto a_probs = models[i]->decode_atten(prev);
-      a_probs_list.emplace_back(F::copy(a_probs, *devs[0]));
+    for_each_model([&](unsigned i) {
+        const auto a_probs = models[i]->decode_atten(prev);
+        if (with_atten) a_probs_list[i] = a_probs;
+        scores_list[i] = models[i]->decode_log_probs(a_probs);
+    });
 
-      const auto scores = models[i]->decode_word(a_probs);
-      scores_list.emplace_back(F::copy(scores, *devs[0]));
+    // Results are gathered by this thread, since devices are not shared by
+    // worker threads.
+    for (unsigned i = 0; i < models.size(); ++i) {
+      if (with_atten) a_probs_list[i] = F::copy(a_probs_list[i], *devs[0]);
+      scores_list[i] = F::copy(scores_list[i], *devs[0]);
     }
 
-    const auto a_probs_mean = F::mean(a_probs_list);
-    const auto scores_sum = F::sum(scores_list);
-
-    ret.atten_probs.emplace_back(a_probs_mean.to_vector());
-    ret.word_ids.emplace_back(::argmax(scores_sum.to_vector()));
+    if (with_atten) {
+      ret.atten_probs.emplace_back(F::mean(a_probs_list).to_vector());
+    }
+    ret.word_ids.emplace_back(
+        models[0]->to_word_id(F::sum(scores_list).argmax(0)[0]));
 
     if (ret.word_ids.size() == limit + 1) {
       ret.word_ids.emplace_back(eos_id);
@@ -98,6 +132,43 @@ inline ::Result infer_sentence_ensemble(
   return ret;
 }
 
+// Greedily decodes a batch of sentences with the same length.
+// Returns target word IDs of each sentence without <bos> and <eos>.
+template<typename Var>
+inline std::vector<std::vector<unsigned>> infer_batch(
+    ::EncoderDecoder<Var> &model,
+    unsigned bos_id, unsigned eos_id,
+    const std::vector<std::vector<unsigned>> &src_batch,
+    unsigned limit) {
+  const unsigned batch_size = src_batch[0].size();
+
+  // Initialize the model
+  model.encode(src_batch);
+  model.init_decoder();
+
+  std::vector<std::vector<unsigned>> hyps(batch_size);
+  std::vector<unsigned> prev(batch_size, bos_id);
+  std::vector<bool> finished(batch_size, false);
+  unsigned num_finished = 0;
+
+  // Decode until all sentences generate <eos>
+  for (unsigned t = 0; t < limit && num_finished < batch_size; ++t) {
+    const auto a_probs = model.decode_atten(prev);
+    prev = model.decode_greedy(a_probs);
+    for (unsigned i = 0; i < batch_size; ++i) {
+      if (finished[i]) continue;
+      if (prev[i] == eos_id) {
+        finished[i] = true;
+        ++num_finished;
+      } else {
+        hyps[i].emplace_back(prev[i]);
+      }
+    }
+  }
+
+  return hyps;
+}
+
 inline std::string make_hyp_str(
     const ::Result &ret, const ::Vocabulary &trg_vocab) {
   std::string hyp_str;
@@ -114,34 +185,214 @@ class NMTTrainer {
   const ::Vocabulary &trg_vocab_;
   ::EncoderDecoder<primitiv::Node> &model_;
   primitiv::Optimizer &opt_;
+  ::LazyAdam *lazy_opt_;
   ::Sampler &train_sampler_;
-  ::Sampler &dev_sampler_;
+  ::SortedBatchSampler dev_sampler_;
   unsigned epoch_;
   float best_dev_avg_loss_;
+  std::unique_ptr<::ReplicaSet> replicas_;
+  std::unique_ptr<::HogwildTrainer> hogwild_;
+  std::unique_ptr<::NegativeSampler> neg_sampler_;
+  ::RingCommunicator *comm_;
+  primitiv::Device *dec_dev_;
+  std::vector<std::vector<unsigned>> dev_sources_;
+  unsigned checkpoint_steps_;
+  unsigned recompute_segment_;
+  unsigned num_keeps_;
+  bool latest_optimizer_only_;
+  bool compress_;
+  primitiv_nmt::proto::TrainerState state_;
+  // Declared before the writers, which use them until destroyed.
+  std::mutex decoding_mutex_;
+  std::string decoding_dir_;  // Checkpoint whose dev hyps are being written.
+  ::CheckpointWriter writer_;
+  ::CheckpointWriter decoder_;  // Generates dev hyps apart from checkpoints.
+  std::vector<std::pair<primitiv::Parameter *, primitiv::Tensor>> masks_;
+
+  bool is_master() const { return !comm_ || comm_->rank() == 0; }
+
+  void set_decoding_dir(const std::string &dir) {
+    std::lock_guard<std::mutex> lock(decoding_mutex_);
+    decoding_dir_ = dir;
+  }
 
-  float process(::Sampler &sampler, bool train) {
-    unsigned num_sents = 0;
-    unsigned num_labels = 0;
+  // Removes old checkpoints on the writer thread, keeping the one being
+  // decoded until its dev hyps are complete.
+  void remove_old_checkpoints(
+      const std::string &model_dir, unsigned num_keeps,
+      bool latest_optimizer_only) {
+    std::string decoding_dir;
+    {
+      std::lock_guard<std::mutex> lock(decoding_mutex_);
+      decoding_dir = decoding_dir_;
+    }
+    ::remove_old_checkpoints(
+        model_dir, num_keeps, latest_optimizer_only, decoding_dir);
+  }
+
+  // Calculates gradients of the batch, and returns the loss summed over the
+  // batch.
+  float compute_gradients(const Batch &batch) {
+    if (replicas_) return replicas_->forward_backward(batch);
+    if (recompute_segment_ > 0) {
+      opt_.reset_gradients();
+      return batch.source[0].size() * model_.backward_recomputed(
+          batch.source, batch.target, recompute_segment_, 1);
+    }
+    primitiv::Graph g;
+    primitiv::Graph::set_default(g);
+    model_.encode(batch.source);
+    model_.init_decoder();
+    const auto loss = ::training_loss(model_, batch, neg_sampler_.get());
+    const float loss_value = g.forward(loss).to_float();
+    opt_.reset_gradients();
+    g.backward(loss);
+    return loss_value * batch.source[0].size();
+  }
+
+  // Updates parameters by calculated gradients. If the optimizer is
+  // ::LazyAdam and `batch` is given, only embeddings of words in the batch
+  // are updated.
+  void update(const Batch *batch = nullptr) {
+    if (lazy_opt_ && batch) {
+      std::vector<unsigned> src_ids, trg_ids;
+      for (const auto &ids : batch->source) {
+        src_ids.insert(src_ids.end(), ids.begin(), ids.end());
+      }
+      for (unsigned i = 0; i + 1 < batch->target.size(); ++i) {
+        const auto &ids = batch->target[i];
+        trg_ids.insert(trg_ids.end(), ids.begin(), ids.end());
+      }
+      lazy_opt_->set_sparse_columns(model_.src_embedding(), src_ids);
+      // The tied embedding also receives gradients from the output layer.
+      if (!model_.config().tie_target_embedding()) {
+        lazy_opt_->set_sparse_columns(model_.trg_embedding(), trg_ids);
+      }
+      lazy_opt_->lazy_update();
+    } else {
+      opt_.update();
+    }
+    for (auto &mask : masks_) {
+      mask.first->value() = mask.first->value() * mask.second;
+    }
+    if (replicas_) replicas_->broadcast();
+  }
+
+  // Trains the model through all batches of the sampler, summing up gradients
+  // over all ranks at each step. Ranks which finished their own batches
+  // contribute zero gradients until all ranks finish.
+  float process_distributed(
+      ::Sampler &sampler, unsigned &num_sents, unsigned &num_labels) {
+    const auto params = ::get_parameters(model_);
+    std::vector<unsigned> offsets {0};
+    for (const primitiv::Parameter *param : params) {
+      offsets.emplace_back(offsets.back() + param->shape().size());
+    }
+    const unsigned total = offsets.back();
+
+    // Gradients followed by #sentences, #labels and the loss.
+    std::vector<float> buf(total + 3);
     float accum_loss = 0;
+
+    while (true) {
+      std::fill(buf.begin(), buf.end(), 0);
+      if (sampler.has_next()) {
+        const Batch batch = sampler.next();
+        const unsigned batch_size = batch.source[0].size();
+        const float loss = compute_gradients(batch);
+        for (unsigned i = 0; i < params.size(); ++i) {
+          const std::vector<float> grad = params[i]->gradient().to_vector();
+          float *dest = buf.data() + offsets[i];
+          for (unsigned j = 0; j < grad.size(); ++j) {
+            dest[j] = grad[j] * batch_size;
+          }
+        }
+        buf[total] = batch_size;
+        buf[total + 1] = batch_size * (batch.target.size() - 1);
+        buf[total + 2] = loss;
+      }
+
+      comm_->all_reduce(buf);
+      if (buf[total] == 0) break;
+
+      const float scale = 1.f / buf[total];
+      for (unsigned i = 0; i < total; ++i) buf[i] *= scale;
+      for (unsigned i = 0; i < params.size(); ++i) {
+        params[i]->gradient().reset_by_array(buf.data() + offsets[i]);
+      }
+      update();
+
+      num_sents += buf[total];
+      num_labels += buf[total + 1];
+      accum_loss += buf[total + 2];
+      std::cout << num_sents << '\r' << std::flush;
+    }
+
+    return accum_loss;
+  }
+
+  // Trains the model through all batches of the sampler.
+  // If the trainer was restored from a step checkpoint, the epoch continues
+  // from the next batch of the checkpoint.
+  float process(::Sampler &sampler) {
+    unsigned step = state_.step();
+    unsigned num_sents = state_.num_sents();
+    unsigned num_labels = state_.num_labels();
+    float accum_loss = state_.accum_loss();
     const unsigned total_sents = sampler.num_sentences();
-    sampler.reset();
+    if (step == 0) sampler.reset();
+
+    // Workers consume all batches in the sampler.
+    if (hogwild_) {
+      accum_loss = hogwild_->process(sampler, num_sents, num_labels);
+    } else if (comm_) {
+      accum_loss = process_distributed(sampler, num_sents, num_labels);
+    }
 
     while (sampler.has_next()) {
       const Batch batch = sampler.next();
       const unsigned batch_size = batch.source[0].size();
 
-      primitiv::Graph g;
-      primitiv::Graph::set_default(g);
-      model_.encode(batch.source);
-      model_.init_decoder();
-      const auto loss = model_.loss(batch.target);
-      accum_loss += g.forward(loss).to_vector()[0] * batch_size;
+      accum_loss += compute_gradients(batch);
+      update(&batch);
 
-      if (train) {
-        opt_.reset_gradients();
-        g.backward(loss);
-        opt_.update();
+      num_sents += batch_size;
+      num_labels += batch_size * (batch.target.size() - 1);
+      std::cout << num_sents << '/' << total_sents << '\r' << std::flush;
+
+      if (checkpoint_steps_ > 0 && ++step % checkpoint_steps_ == 0) {
+        state_.set_step(step);
+        state_.set_accum_loss(accum_loss);
+        state_.set_num_sents(num_sents);
+        state_.set_num_labels(num_labels);
+        save_step();
       }
+    }
+    state_.Clear();
+
+    return accum_loss / num_labels;
+  }
+
+  // Calculates the average loss over the dev corpus.
+  // Only forward calculation is performed on a copy of the model using
+  // tensors, hence no computation graph is kept.
+  float evaluate() {
+    ::EncoderDecoder<primitiv::Tensor> model(model_.config());
+    const auto params = ::get_parameters(model_);
+    ::clone_parameters(model_, model, params[0]->device());
+
+    unsigned num_sents = 0;
+    unsigned num_labels = 0;
+    float accum_loss = 0;
+    const unsigned total_sents = dev_sampler_.num_sentences();
+    dev_sampler_.reset();
+
+    while (dev_sampler_.has_next()) {
+      const Batch batch = dev_sampler_.next();
+      const unsigned batch_size = batch.source[0].size();
+      model.encode(batch.source);
+      model.init_decoder();
+      accum_loss += model.loss(batch.target).to_float() * batch_size;
 
       num_sents += batch_size;
       num_labels += batch_size * (batch.target.size() - 1);
@@ -151,26 +402,47 @@ class NMTTrainer {
     return accum_loss / num_labels;
   }
 
-  std::vector<std::string> infer_corpus(::Sampler &sampler) {
-    std::vector<std::string> hyps;
-    sampler.reset();
-
+  // Generates hypotheses of the dev corpus. Sentences with the same length
+  // are decoded together in one batch.
+  std::vector<std::string> infer_corpus(
+      ::EncoderDecoder<primitiv::Tensor> &model) const {
+    const unsigned max_batch_size = 64;
+    const unsigned num_sents = dev_sources_.size();
     const unsigned bos_id = trg_vocab_.stoi("<bos>");
     const unsigned eos_id = trg_vocab_.stoi("<eos>");
 
-    while (sampler.has_next()) {
-      const Batch batch = sampler.next();
-      const unsigned batch_size = batch.source[0].size();
-      if (batch_size != 1) {
-        throw std::runtime_error(
-            "inference is allowed only for each one sentence.");
+    std::vector<unsigned> ids(num_sents);
+    std::iota(ids.begin(), ids.end(), 0);
+    std::stable_sort(ids.begin(), ids.end(), [&](unsigned a, unsigned b) {
+        return dev_sources_[a].size() < dev_sources_[b].size();
+    });
+
+    std::vector<std::string> hyps(num_sents);
+    unsigned first = 0;
+    while (first < num_sents) {
+      const unsigned src_len = dev_sources_[ids[first]].size();
+      unsigned last = first + 1;
+      while (last < num_sents
+          && last - first < max_batch_size
+          && dev_sources_[ids[last]].size() == src_len) ++last;
+
+      std::vector<std::vector<unsigned>> src_batch(
+          src_len, std::vector<unsigned>(last - first));
+      for (unsigned i = first; i < last; ++i) {
+        for (unsigned j = 0; j < src_len; ++j) {
+          src_batch[j][i - first] = dev_sources_[ids[i]][j];
+        }
       }
 
-      primitiv::Graph g;
-      primitiv::Graph::set_default(g);
-      const ::Result ret = ::infer_sentence(
-          model_, bos_id, eos_id, batch.source, 64);
-      hyps.emplace_back(::make_hyp_str(ret, trg_vocab_));
+      const auto results = ::infer_batch(model, bos_id, eos_id, src_batch, 64);
+      for (unsigned i = first; i < last; ++i) {
+        ::Result ret { {bos_id}, {} };
+        const auto &hyp = results[i - first];
+        ret.word_ids.insert(ret.word_ids.end(), hyp.begin(), hyp.end());
+        ret.word_ids.emplace_back(eos_id);
+        hyps[ids[i]] = ::make_hyp_str(ret, trg_vocab_);
+      }
+      first = last;
     }
 
     return hyps;
@@ -184,56 +456,305 @@ public:
       ::EncoderDecoder<primitiv::Node> &model,
       primitiv::Optimizer &trainer,
       ::Sampler &train_sampler,
-      ::Sampler &dev_sampler,
-      unsigned epoch)
+      const primitiv_nmt::proto::Corpus &dev_corpus,
+      unsigned epoch,
+      ::RingCommunicator *comm = nullptr)
     : model_dir_(model_dir), src_vocab_(src_vocab), trg_vocab_(trg_vocab)
     , model_(model), opt_(trainer)
-    , train_sampler_(train_sampler), dev_sampler_(dev_sampler)
+    , lazy_opt_(dynamic_cast<::LazyAdam *>(&trainer))
+    , train_sampler_(train_sampler), dev_sampler_(dev_corpus, 64)
     , epoch_(epoch)
-    , best_dev_avg_loss_(
-        ::load_value<float>(model_dir + "/best.dev_avg_loss")) {}
+    , best_dev_avg_loss_(0)
+    , comm_(comm)
+    , dec_dev_(nullptr)
+    , checkpoint_steps_(0)
+    , recompute_segment_(0)
+    , num_keeps_(0)
+    , latest_optimizer_only_(false)
+    , compress_(false) {
+    for (const auto &sample : dev_corpus.samples()) {
+      const auto &src_ids = sample.source().token_ids();
+      dev_sources_.emplace_back(src_ids.begin(), src_ids.end());
+    }
+    if (is_master()) {
+      best_dev_avg_loss_ = ::load_value<float>(
+          model_dir + "/best.dev_avg_loss");
+    }
+    if (comm_) {
+      // All ranks start from the parameters of rank 0.
+      best_dev_avg_loss_ = comm_->broadcast(best_dev_avg_loss_);
+      for (primitiv::Parameter *param : ::get_parameters(model_)) {
+        std::vector<float> value = param->value().to_vector();
+        if (!is_master()) std::fill(value.begin(), value.end(), 0);
+        comm_->all_reduce(value);
+        param->value().reset_by_vector(value);
+      }
+    }
+  }
 
+  // Enables data-parallel training with given number of threads.
+  // Each worker holds its own replica of the model on its own device.
+  // If `hogwild` is true, workers update the shared parameters
+  // asynchronously without locks, otherwise gradients of each batch are
+  // all-reduced before a single update.
+  void set_num_workers(
+      unsigned num_workers, primitiv::Device &dev, bool hogwild) {
+    hogwild_.reset();
+    replicas_.reset();
+    if (num_workers > 1 || hogwild) {
+      replicas_.reset(new ::ReplicaSet(model_, dev, num_workers));
+      replicas_->set_negative_sampler(neg_sampler_.get());
+      replicas_->set_recompute_segment(recompute_segment_);
+    }
+    if (hogwild) {
+      if (comm_) {
+        throw std::runtime_error(
+            "Hogwild training can not be used with multiple processes.");
+      }
+      hogwild_.reset(new ::HogwildTrainer(*replicas_, opt_));
+    }
+  }
+
+  // Sets the device used to generate dev hyps in the background.
+  // This device should not be used by the training loop. If not set, dev
+  // hyps are generated on the host memory.
+  void set_decoder_device(primitiv::Device &dev) { dec_dev_ = &dev; }
+
+  // Enables sampled softmax with `num_samples` negative samples per batch.
+  // 0 disables it. The dev loss is always calculated by full softmax.
+  // `seed` is ignored if the state restored by load_state() has the state of
+  // negative sampling.
+  void set_sampled_softmax(unsigned num_samples, unsigned seed) {
+    neg_sampler_.reset();
+    if (num_samples > 0) {
+      if (recompute_segment_ > 0) {
+        throw std::runtime_error(
+            "Sampled softmax can not be used with recomputation.");
+      }
+      if (model_.config().adaptive_softmax_cutoffs_size() > 0) {
+        throw std::runtime_error(
+            "Sampled softmax can not be used with adaptive softmax.");
+      }
+      neg_sampler_.reset(new ::NegativeSampler(trg_vocab_, num_samples, seed));
+      if (!state_.negative_rng().empty()) {
+        neg_sampler_->set_rng_state(state_.negative_rng());
+      }
+    }
+    if (replicas_) replicas_->set_negative_sampler(neg_sampler_.get());
+  }
+
+  // Recomputes activations of the decoder in segments of `segment_size` steps
+  // during the backward pass to reduce the peak memory. 0 disables it.
+  void set_recompute_segment(unsigned segment_size) {
+    if (segment_size > 0 && neg_sampler_) {
+      throw std::runtime_error(
+          "Sampled softmax can not be used with recomputation.");
+    }
+    recompute_segment_ = segment_size;
+    if (replicas_) replicas_->set_recompute_segment(segment_size);
+  }
+
+  // Keeps zero elements of weight matrices zero after each update, e.g., to
+  // fine-tune a model pruned by the `prune` tool.
+  void set_keep_sparsity(bool keep) {
+    namespace F = primitiv::functions;
+    masks_.clear();
+    if (!keep) return;
+    if (hogwild_) {
+      throw std::runtime_error(
+          "Sparsity can not be kept with hogwild training.");
+    }
+    for (primitiv::Parameter *param : ::get_parameters(model_)) {
+      const primitiv::Shape &shape = param->shape();
+      if (shape.depth() != 2) continue;
+      std::vector<float> mask = param->value().to_vector();
+      bool has_zero = false;
+      for (float &m : mask) {
+        if (m == 0) has_zero = true;
+        m = m != 0;
+      }
+      if (has_zero) {
+        masks_.emplace_back(
+            param, F::input<primitiv::Tensor>(shape, mask, param->device()));
+      }
+    }
+  }
+
+  // Saves the current model asynchronously. Parameters and the optimizer
+  // state are copied before returning. If `decode` is true, dev hyps are
+  // generated from the copied parameters after the checkpoint is written,
+  // while the training continues. Decoding runs on its own thread, hence
+  // following step checkpoints do not wait for it.
   void save(
       float train_avg_loss,
       float dev_avg_loss,
-      const std::vector<std::string> &dev_hyps) {
-    const std::string subdir = ::get_model_dir(model_dir_, epoch_);
-    ::make_directory(subdir);
-    model_.save(subdir + "/model");
-    opt_.save(subdir + "/trainer");
-    ::save_value(subdir + "/train.avg_loss", train_avg_loss);
-    ::save_value(subdir + "/dev.avg_loss", dev_avg_loss);
-    ::save_strings(subdir + "/dev.hyp", dev_hyps);
+      bool best = false,
+      bool decode = true) {
+    std::shared_ptr<::EncoderDecoder<primitiv::Tensor>> model(
+        new ::EncoderDecoder<primitiv::Tensor>(model_.config()));
+    writer_.wait();
+    decoder_.wait();
+    decoder_.snapshot(model_, *model, dec_dev_);
+    // Set after the checkpoint directory is renamed, or broken on failure.
+    const std::shared_ptr<std::promise<void>> written(new std::promise<void>);
+    const std::shared_future<void> written_future = written->get_future();
+    const std::shared_ptr<::OptimizerSnapshot> opt(
+        new ::OptimizerSnapshot(opt_));
+
+    const std::string model_dir = model_dir_;
+    const std::string subdir = ::get_model_dir(model_dir, epoch_);
+    const unsigned epoch = epoch_;
+    const unsigned num_dev_sents = dev_sources_.size();
+    const unsigned num_keeps = num_keeps_;
+    const bool latest_optimizer_only = latest_optimizer_only_;
+    const bool packed = latest_optimizer_only_ || compress_;
+    const bool compress = compress_;
+    if (decode) set_decoding_dir(subdir);
+    writer_.write(
+        subdir,
+        [=](const std::string &tmp_dir) {
+          ::save_checkpoint_model(*model, tmp_dir, packed, compress);
+          opt->save(tmp_dir + "/trainer");
+          ::save_value(tmp_dir + "/train.avg_loss", train_avg_loss);
+          ::save_value(tmp_dir + "/dev.avg_loss", dev_avg_loss);
+          if (!decode) {
+            ::save_strings(
+                tmp_dir + "/dev.hyp", std::vector<std::string>(num_dev_sents));
+          }
+        },
+        [=]() {
+          if (best) {
+            ::save_value(model_dir + "/best.epoch", epoch);
+            ::save_value(model_dir + "/best.dev_avg_loss", dev_avg_loss);
+          }
+          if (num_keeps > 0 || latest_optimizer_only) {
+            remove_old_checkpoints(
+                model_dir, num_keeps, latest_optimizer_only);
+          }
+          written->set_value();
+        });
+    if (decode) {
+      decoder_.run([=]() {
+          written_future.get();
+          ::save_strings(subdir + "/dev.hyp", infer_corpus(*model));
+          set_decoding_dir("");
+      });
+    }
   }
 
+  // Saves a checkpoint in the middle of the epoch, including the state of the
+  // train sampler.
+  void save_step() {
+    primitiv_nmt::proto::TrainerState state = state_;
+    state.set_epoch(epoch_ - 1);
+    train_sampler_.get_state(*state.mutable_sampler());
+    if (neg_sampler_) state.set_negative_rng(neg_sampler_->get_rng_state());
+
+    std::shared_ptr<::EncoderDecoder<primitiv::Tensor>> model(
+        new ::EncoderDecoder<primitiv::Tensor>(model_.config()));
+    writer_.wait();
+    writer_.snapshot(model_, *model);
+    const std::shared_ptr<::OptimizerSnapshot> opt(
+        new ::OptimizerSnapshot(opt_));
+
+    const std::string model_dir = model_dir_;
+    const unsigned num_keeps = num_keeps_;
+    const bool latest_optimizer_only = latest_optimizer_only_;
+    const bool packed = latest_optimizer_only_ || compress_;
+    const bool compress = compress_;
+    writer_.write(
+        ::get_step_dir(model_dir, epoch_ - 1, state.step()),
+        [=](const std::string &tmp_dir) {
+          ::save_checkpoint_model(*model, tmp_dir, packed, compress);
+          opt->save(tmp_dir + "/trainer");
+          ::save_proto(tmp_dir + "/state", state);
+        },
+        [=]() {
+          if (num_keeps > 0 || latest_optimizer_only) {
+            remove_old_checkpoints(
+                model_dir, num_keeps, latest_optimizer_only);
+          }
+        });
+  }
+
+  // Enables saving checkpoints every `num_steps` updates.
+  // Step checkpoints are supported only with synchronous training in a
+  // single process.
+  void set_checkpoint_steps(unsigned num_steps) {
+    if (num_steps > 0 && (hogwild_ || comm_)) {
+      throw std::runtime_error(
+          "Step checkpoints can not be used with hogwild or multiple "
+          "processes.");
+    }
+    checkpoint_steps_ = num_steps;
+  }
+
+  // Sets how checkpoints are stored. Only the latest `num_keeps` checkpoints
+  // and the best epoch are kept if `num_keeps` > 0. Optimizer statistics are
+  // kept only in the latest checkpoint if `latest_optimizer_only` is true.
+  // Parameters are compressed by zlib if `compress` is true.
+  void set_checkpoint_policy(
+      unsigned num_keeps, bool latest_optimizer_only, bool compress) {
+    num_keeps_ = num_keeps;
+    latest_optimizer_only_ = latest_optimizer_only;
+    compress_ = compress;
+  }
+
+  // Restores the progress of the epoch saved by a step checkpoint.
+  void load_state(const std::string &path) {
+    if (hogwild_ || comm_) {
+      throw std::runtime_error(
+          "Step checkpoints can not be used with hogwild or multiple "
+          "processes.");
+    }
+    ::load_proto(path, state_);
+    if (state_.epoch() != epoch_) {
+      throw std::runtime_error("Epoch of the trainer state mismatched.");
+    }
+    train_sampler_.set_state(state_.sampler());
+    if (neg_sampler_ && !state_.negative_rng().empty()) {
+      neg_sampler_->set_rng_state(state_.negative_rng());
+    }
+  }
+
+  // Waits until all checkpoints and dev hyps are written.
+  void wait_for_save() {
+    writer_.wait();
+    decoder_.wait();
+  }
+
+  // Runs one epoch. When multiple processes are used, only rank 0 runs dev
+  // evaluation and writes files.
   void train() {
     std::cout << "Epoch " << ++epoch_ << ':' << std::endl;
     std::cout << "  Learning rate decay: "
               << opt_.get_learning_rate_scaling() << std::endl;
 
-    float train_avg_loss = process(train_sampler_, true);
+    float train_avg_loss = process(train_sampler_);
     std::cout << "  Train loss: " << train_avg_loss << std::endl;
 
-    float dev_avg_loss = process(dev_sampler_, false);
-    std::cout << "  Dev loss: " << dev_avg_loss << std::endl;
+    float dev_avg_loss = 0;
+    if (is_master()) {
+      dev_avg_loss = evaluate();
+      std::cout << "  Dev loss: " << dev_avg_loss << std::endl;
+    }
+    if (comm_) dev_avg_loss = comm_->broadcast(dev_avg_loss);
 
-    if (dev_avg_loss < best_dev_avg_loss_) {
+    const bool best = dev_avg_loss < best_dev_avg_loss_;
+    if (best) {
       std::cout << "    Best!" << std::endl;
       best_dev_avg_loss_ = dev_avg_loss;
-      ::save_value(model_dir_ + "/best.epoch", epoch_);
-      ::save_value(model_dir_ + "/best.dev_avg_loss", best_dev_avg_loss_);
     } else {
       const float prev_lr_decay = opt_.get_learning_rate_scaling();
       opt_.set_learning_rate_scaling(.5f * prev_lr_decay);
     }
 
-    std::cout << "  Generating dev hyps ... " << std::flush;
-    const std::vector<std::string> dev_hyps = infer_corpus(dev_sampler_);
-    std::cout << "done." << std::endl;
+    if (!is_master()) return;
 
-    std::cout << "  Saving current model ... " << std::flush;
-    save(train_avg_loss, dev_avg_loss, dev_hyps);
-    std::cout << "done." << std::endl;
+    std::cout << "  Saving current model and generating dev hyps ... "
+              << std::flush;
+    save(train_avg_loss, dev_avg_loss, best);
+    std::cout << "started." << std::endl;
   }
 };
 
@@ -0,0 +1,86 @@
+#include <primitiv_nmt/config.h>
+
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <primitiv/primitiv.h>
+
+#include <primitiv_nmt/compressed_model.h>
+#include <primitiv_nmt/encoder_decoder.h>
+#include <primitiv_nmt/sparse.h>
+#include <primitiv_nmt/utils.h>
+
+using namespace std;
+
+int main(int argc, char *argv[]) {
+  const auto opts = ::check_args(argc, argv, {
+      "(dir/in/out) Model directory",
+      "(int) Epoch",
+      "(float) Ratio of zero blocks in each weight matrix",
+      "(int) Epoch of the pruned model",
+  }, {
+      {"block", "1x1",
+        "(str) Block size <rows>x<cols> pruned together (1x1: unstructured)"},
+  });
+
+  ::global_try_block([&]() {
+      const string model_dir = *++argv;
+      const unsigned epoch = stoi(*++argv);
+      const float sparsity = stof(*++argv);
+      const unsigned out_epoch = stoi(*++argv);
+      const auto block = ::parse_block_size(opts.at("block"));
+      if (sparsity < 0 || sparsity > 1) {
+        throw runtime_error("Sparsity should be in [0, 1].");
+      }
+
+      const string subdir = ::get_model_dir(model_dir, epoch);
+      const string out_dir = ::get_model_dir(model_dir, out_epoch);
+      if (::path_exists(out_dir)) {
+        throw runtime_error("Directory already exists: " + out_dir);
+      }
+
+      primitiv::devices::Eigen dev;
+      primitiv::Device::set_default(dev);
+
+      ::EncoderDecoder<primitiv::Tensor> model(
+          ::load_model_config(model_dir));
+      ::load_checkpoint_model(model, subdir, true);
+      primitiv::optimizers::Adam opt;
+      opt.load(subdir + "/trainer");
+
+      // Prunes all weight matrices except embeddings. Vectors stored as
+      // matrices, e.g., {1, h}, are also skipped.
+      unsigned num_total = 0, num_zeros = 0;
+      for (const auto &kv : model.get_all_parameters()) {
+        const vector<string> &path = kv.first;
+        primitiv::Parameter &param = *kv.second;
+        const primitiv::Shape &shape = param.shape();
+        if (shape.depth() != 2 || shape[0] == 1 || shape[1] == 1) continue;
+        if (path[0] == "src_emb" || path[0] == "trg_emb") continue;
+        vector<float> value = param.value().to_vector();
+        ::prune_blocks(
+            value, shape[0], shape[1], sparsity, block.first, block.second);
+        param.value().reset_by_vector(value);
+
+        unsigned n = 0;
+        for (const float v : value) n += v == 0;
+        num_total += value.size();
+        num_zeros += n;
+        string name;
+        for (const string &p : path) name += (name.empty() ? "" : ".") + p;
+        cout << name << ": " << shape.to_string() << ", sparsity="
+          << static_cast<float>(n) / value.size() << endl;
+      }
+      cout << "Total sparsity of pruned matrices: "
+        << static_cast<float>(num_zeros) / num_total << endl;
+
+      ::make_directory(out_dir);
+      model.save(out_dir + "/model");
+      opt.save(out_dir + "/trainer");
+      cout << "Pruned model saved to: " << out_dir << endl;
+  });
+
+  return 0;
+}
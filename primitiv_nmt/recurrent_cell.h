@@ -0,0 +1,62 @@
+#ifndef PRIMITIV_NMT_RECURRENT_CELL_H_
+#define PRIMITIV_NMT_RECURRENT_CELL_H_
+
+#include <vector>
+
+#include <primitiv/primitiv.h>
+
+// Interface of recurrent cells whose input enters only through an affine
+// transform W_x . x[t] + b, which does not depend on previous states.
+template<typename Var>
+class RecurrentCell : public primitiv::Model {
+public:
+  virtual ~RecurrentCell() = default;
+
+  // Initializes parameters.
+  virtual void init(unsigned input_size, unsigned output_size) = 0;
+
+  // Initializes internal values.
+  virtual void reset(const Var &init_c, const Var &init_h) = 0;
+
+  // One step forwarding.
+  virtual Var forward(const Var &x) = 0;
+
+  // One step forwarding with precomputed W_x . x[t] + b.
+  virtual Var forward_projected(const Var &wxb) = 0;
+
+  // Calculates W_x . X for inputs of any number of columns.
+  virtual Var project(const Var &xs) = 0;
+
+  // Retrieves columns [lower, upper) of W_x and the bias.
+  virtual Var get_wx(unsigned lower, unsigned upper) = 0;
+  virtual Var get_b() = 0;
+
+  // Uses sparse copies of weight matrices whose blocks are zero at least
+  // `min_sparsity`. Only for inference.
+  virtual void make_sparse(
+      float min_sparsity, unsigned block_rows, unsigned block_cols) = 0;
+
+  // Retrieves current states.
+  virtual Var get_c() const = 0;
+  virtual Var get_h() const = 0;
+
+  // Retrieves hyperparameters.
+  virtual unsigned input_size() const = 0;
+  virtual unsigned output_size() const = 0;
+
+  // Forwards all steps of the sequence. Input transforms of all steps are
+  // calculated by one matrix multiplication before the recurrence.
+  std::vector<Var> forward_sequence(const std::vector<Var> &xs) {
+    namespace F = primitiv::functions;
+    const unsigned len = xs.size();
+    const Var wxb = project(F::concat(xs, 1))
+      + F::broadcast(get_b(), 1, len);  // {gates * out_size, len}
+    std::vector<Var> hs;
+    for (unsigned t = 0; t < len; ++t) {
+      hs.emplace_back(forward_projected(F::slice(wxb, 1, t, t + 1)));
+    }
+    return hs;
+  }
+};
+
+#endif  // PRIMITIV_NMT_RECURRENT_CELL_H_
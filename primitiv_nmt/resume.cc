@@ -1,13 +1,19 @@
 #include <primitiv_nmt/config.h>
 
 #include <iostream>
+#include <memory>
 #include <random>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
 #include <primitiv/primitiv.h>
 
+#include <primitiv_nmt/compressed_model.h>
+#include <primitiv_nmt/cpu_affinity.h>
+#include <primitiv_nmt/distributed.h>
 #include <primitiv_nmt/encoder_decoder.h>
+#include <primitiv_nmt/lazy_adam.h>
 #include <primitiv_nmt/nmt_utils.h>
 #include <primitiv_nmt/lstm.h>
 #include <primitiv_nmt/primitiv_nmt.pb.h>
@@ -16,7 +22,7 @@
 #include <primitiv_nmt/vocabulary.h>
 
 int main(int argc, char *argv[]) {
-  ::check_args(argc, argv, {
+  const auto opts = ::check_args(argc, argv, {
       "(file/in) Train corpus file",
       "(file/in) Dev corpus file",
       "(file/in) Source vocabulary file",
@@ -27,6 +33,49 @@ int main(int argc, char *argv[]) {
 #ifdef PRIMITIV_NMT_USE_CUDA
       "(int) GPU ID",
 #endif
+  }, {
+      {"config", "",
+        "(file/in) Config file of default option values, e.g., written by "
+        "autotune"},
+      {"workers", "1", "(int) Number of data-parallel worker threads"},
+#ifndef PRIMITIV_NMT_USE_CUDA
+      {"intra-threads", "0",
+        "(int) Number of threads used by each tensor operation "
+        "(0: OpenMP default)"},
+      {"cpus", "", "(str) Pins the process to CPUs, e.g., 0-7,16-23"},
+      {"numa-node", "-1",
+        "(int) Runs the process and allocates its memory on the NUMA node "
+        "(-1: disabled)"},
+#endif
+      {"max-batch-tokens", "",
+        "(int) Max number of source and target tokens in a batch "
+        "(0: no limit, empty: same as train)"},
+      {"hogwild", "0", "(0/1) Lock-free asynchronous updates by workers"},
+      {"rank", "0", "(int) Rank of this process"},
+      {"world-size", "1", "(int) Number of processes"},
+      {"hosts", "localhost:21000",
+        "(str) Comma-separated host:port of all ranks, or base host:port"},
+      {"checkpoint-steps", "0",
+        "(int) Saves a checkpoint every N steps (0: disabled)"},
+      {"keep-checkpoints", "0",
+        "(int) Keeps only the latest N checkpoints and the best one "
+        "(0: all)"},
+      {"latest-optimizer-only", "0",
+        "(0/1) Keeps optimizer statistics only in the latest checkpoint"},
+      {"compress-checkpoints", "0", "(0/1) Compresses parameter files"},
+      {"sampled-softmax", "0",
+        "(int) Number of negative samples per batch (0: full softmax)"},
+      {"seed", "",
+        "(int) Seed of batch and negative sampling (empty: random)"},
+      {"recompute-segment", "0",
+        "(int) Recomputes decoder activations in segments of N steps during "
+        "backward to save memory (0: disabled)"},
+      {"lazy-adam", "0",
+        "(0/1) Updates only embeddings of words in each batch"},
+      {"keep-sparsity", "0",
+        "(0/1) Keeps zero weights zero, e.g., to fine-tune a pruned model"},
+      {"step", "0",
+        "(int) Resumes from the checkpoint after N steps of the next epoch"},
   });
 
   ::global_try_block([&]() {
@@ -40,9 +89,39 @@ int main(int argc, char *argv[]) {
 #ifdef PRIMITIV_NMT_USE_CUDA
       const unsigned gpu_id = std::stoi(*++argv);
 #endif
+      const unsigned num_workers = std::stoi(opts.at("workers"));
+      const bool hogwild = std::stoi(opts.at("hogwild"));
+      const unsigned rank = std::stoi(opts.at("rank"));
+      const unsigned world_size = std::stoi(opts.at("world-size"));
+      const unsigned checkpoint_steps = std::stoi(opts.at("checkpoint-steps"));
+      const unsigned num_keeps = std::stoi(opts.at("keep-checkpoints"));
+      const bool latest_optimizer_only =
+        std::stoi(opts.at("latest-optimizer-only"));
+      const bool compress = std::stoi(opts.at("compress-checkpoints"));
+      const unsigned num_neg_samples = std::stoi(opts.at("sampled-softmax"));
+      const unsigned seed = opts.at("seed").empty()
+        ? std::random_device()() : std::stoul(opts.at("seed"));
+      const unsigned step = std::stoi(opts.at("step"));
+      const bool lazy_adam = std::stoi(opts.at("lazy-adam"));
+      const unsigned recompute_segment =
+        std::stoi(opts.at("recompute-segment"));
+      const bool keep_sparsity = std::stoi(opts.at("keep-sparsity"));
+      if (lazy_adam && (hogwild || world_size > 1)) {
+        throw std::runtime_error(
+            "Lazy Adam can not be used with hogwild or multiple processes.");
+      }
+#ifndef PRIMITIV_NMT_USE_CUDA
+      ::apply_cpu_options(opts);
+#endif
 
       const unsigned batch_size = ::load_value<unsigned>(
           model_dir + "/batch_size");
+      unsigned max_tokens = 0;
+      if (!opts.at("max-batch-tokens").empty()) {
+        max_tokens = std::stoi(opts.at("max-batch-tokens"));
+      } else if (::path_exists(model_dir + "/max_batch_tokens")) {
+        max_tokens = ::load_value<unsigned>(model_dir + "/max_batch_tokens");
+      }
 
       std::cout << "Loading vocabularies ... " << std::flush;
       const ::Vocabulary src_vocab(src_vocab_file);
@@ -53,39 +132,70 @@ int main(int argc, char *argv[]) {
       primitiv_nmt::proto::Corpus train_corpus, dev_corpus;
       ::load_proto(train_corpus_file, train_corpus);
       ::load_proto(dev_corpus_file, dev_corpus);
-      std::random_device rd;
-      ::RandomBatchSampler train_sampler(train_corpus, batch_size, rd());
-      ::MonotoneSampler dev_sampler(dev_corpus);
+      ::shard_corpus(train_corpus, rank, world_size);
+      ::RandomBatchSampler train_sampler(
+          train_corpus, batch_size, seed, max_tokens);
       std::cout << "done." << std::endl;
 
       std::cout << "Initializing devices ... " << std::flush;
 #ifdef PRIMITIV_NMT_USE_CUDA
       primitiv::devices::CUDA dev(gpu_id);
+      primitiv::devices::CUDA dec_dev(gpu_id);
 #else
       primitiv::devices::Eigen dev;
+      primitiv::devices::Eigen dec_dev;
 #endif
       primitiv::Device::set_default(dev);
       std::cout << "done." << std::endl;
 
-      const std::string last_dir = ::get_model_dir(model_dir, last_epoch);
+      const std::string last_dir = step > 0
+        ? ::get_step_dir(model_dir, last_epoch, step)
+        : ::get_model_dir(model_dir, last_epoch);
 
       std::cout << "Loading model ... " << std::flush;
-      ::EncoderDecoder<primitiv::Node> model;
-      model.load(last_dir + "/model");
+      ::EncoderDecoder<primitiv::Node> model(
+          ::load_model_config(model_dir));
+      const bool with_stats = ::load_checkpoint_model(model, last_dir, true);
       std::cout << "done." << std::endl;
+      if (!with_stats) {
+        std::cerr << "WARNING: optimizer statistics not found, "
+          << "restarting Adam from step 0." << std::endl;
+      }
 
       std::cout << "Loading trainer ... " << std::flush;
-      primitiv::optimizers::Adam opt;
-      opt.load(last_dir + "/trainer");
-      opt.add(model);
+      std::unique_ptr<primitiv::optimizers::Adam> opt;
+      if (lazy_adam) {
+        opt.reset(new ::LazyAdam());
+      } else {
+        opt.reset(new primitiv::optimizers::Adam());
+      }
+      opt->load(last_dir + "/trainer");
+      // Bias corrections of zero moments should also start over.
+      if (!with_stats) opt->set_epoch(0);
+      opt->add(model);
+      std::cout << "done." << std::endl;
+
+      std::cout << "Connecting processes ... " << std::flush;
+      ::RingCommunicator comm(
+          rank, world_size, ::make_addresses(opts.at("hosts"), world_size));
       std::cout << "done." << std::endl;
 
       NMTTrainer trainer(
           model_dir, src_vocab, trg_vocab, model,
-          opt, train_sampler, dev_sampler, last_epoch);
+          *opt, train_sampler, dev_corpus, last_epoch,
+          world_size > 1 ? &comm : nullptr);
+      trainer.set_num_workers(num_workers, dev, hogwild);
+      trainer.set_decoder_device(dec_dev);
+      trainer.set_checkpoint_steps(checkpoint_steps);
+      trainer.set_checkpoint_policy(num_keeps, latest_optimizer_only, compress);
+      trainer.set_sampled_softmax(num_neg_samples, seed + 1);
+      trainer.set_recompute_segment(recompute_segment);
+      trainer.set_keep_sparsity(keep_sparsity);
+      if (step > 0) trainer.load_state(last_dir + "/state");
 
       std::cout << "Restart training." << std::endl;
       for (unsigned i = 0; i < num_epochs; ++i) trainer.train();
+      trainer.wait_for_save();
       std::cout << "Finished." << std::endl;
   });
 
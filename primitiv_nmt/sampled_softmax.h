@@ -0,0 +1,96 @@
+#ifndef PRIMITIV_NMT_SAMPLED_SOFTMAX_H_
+#define PRIMITIV_NMT_SAMPLED_SOFTMAX_H_
+
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <primitiv_nmt/encoder_decoder.h>
+#include <primitiv_nmt/sampler.h>
+#include <primitiv_nmt/vocabulary.h>
+
+// Draws negative samples of target words for sampled softmax from the
+// unigram distribution given by Vocabulary::prob().
+class NegativeSampler {
+  const unsigned num_samples_;
+  std::discrete_distribution<unsigned> dist_;
+  std::vector<float> log_q_;
+  std::mt19937 rng_;
+  std::mutex mutex_;
+
+  NegativeSampler(const NegativeSampler &) = delete;
+  NegativeSampler &operator=(const NegativeSampler &) = delete;
+
+  // Words without frequencies (e.g., <bos> and <eos>) are also sampled with
+  // this small probability.
+  static float smoothed_prob(const ::Vocabulary &vocab, unsigned id) {
+    return std::max(vocab.prob(id), 1e-7f);
+  }
+
+public:
+  NegativeSampler(
+      const ::Vocabulary &vocab, unsigned num_samples, unsigned seed)
+    : num_samples_(num_samples), rng_(seed) {
+    std::vector<double> probs;
+    for (unsigned i = 0; i < vocab.size(); ++i) {
+      probs.emplace_back(smoothed_prob(vocab, i));
+    }
+    dist_ = std::discrete_distribution<unsigned>(probs.begin(), probs.end());
+    // Expected count of each word in the unique samples:
+    //   1 - (1 - p)^num_samples
+    for (const double p : dist_.probabilities()) {
+      log_q_.emplace_back(std::log(-std::expm1(
+              num_samples * std::log1p(-std::min(p, 1 - 1e-7)))));
+    }
+  }
+
+  // Returns sorted unique samples.
+  std::vector<unsigned> sample() {
+    std::vector<unsigned> ids;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (unsigned i = 0; i < num_samples_; ++i) ids.emplace_back(dist_(rng_));
+    }
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    return ids;
+  }
+
+  // Saves/restores the state of the random number generator, e.g., to resume
+  // training from a step checkpoint.
+  std::string get_rng_state() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::ostringstream oss;
+    oss << rng_;
+    return oss.str();
+  }
+
+  void set_rng_state(const std::string &state) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::istringstream iss(state);
+    iss >> rng_;
+  }
+
+  // Retrieves the log of expected counts of all words.
+  const std::vector<float> &log_q() const { return log_q_; }
+};
+
+// Calculates the training loss of the batch. Uses sampled softmax if
+// `sampler` is not nullptr, otherwise full softmax. Negative samples are
+// drawn from `sampler` unless `neg_ids` is given, e.g., to share the same
+// samples among sub-batches of one batch.
+template<typename Var>
+inline Var training_loss(
+    ::EncoderDecoder<Var> &model, const Batch &batch,
+    ::NegativeSampler *sampler,
+    const std::vector<unsigned> *neg_ids = nullptr) {
+  if (!sampler) return model.loss(batch.target);
+  return model.sampled_loss(
+      batch.target, neg_ids ? *neg_ids : sampler->sample(), sampler->log_q());
+}
+
+#endif  // PRIMITIV_NMT_SAMPLED_SOFTMAX_H_
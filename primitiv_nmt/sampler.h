@@ -2,7 +2,10 @@
 #define PRIMITIV_NMT_SAMPLER_H_
 
 #include <algorithm>
+#include <numeric>
 #include <random>
+#include <sstream>
+#include <utility>
 #include <stdexcept>
 #include <vector>
 
@@ -23,47 +26,103 @@ public:
   virtual Batch next() = 0;
   virtual bool has_next() const = 0;
   virtual unsigned num_sentences() const = 0;
-};
-
-class MonotoneSampler : public Sampler {
-  const primitiv_nmt::proto::Corpus &corpus_;
-  unsigned pos_;
-
-  MonotoneSampler(const MonotoneSampler &) = delete;
-  MonotoneSampler &operator=(const MonotoneSampler &) = delete;
-
-public:
-  MonotoneSampler(const primitiv_nmt::proto::Corpus &corpus)
-    : corpus_(corpus), pos_(0) {}
 
-  void reset() override { pos_ = 0; }
+  // Saves/restores the current position and random state.
+  virtual void get_state(primitiv_nmt::proto::SamplerState &state) const = 0;
+  virtual void set_state(const primitiv_nmt::proto::SamplerState &state) = 0;
+};
 
-  Batch next() override {
-    if (!has_next()) throw std::runtime_error("No next batch.");
-    const auto &sample = corpus_.samples()[pos_];
-    Batch batch;
-    batch.source.reserve(sample.source().token_ids_size());
-    for (const unsigned tok_id : sample.source().token_ids()) {
-      batch.source.emplace_back(std::vector<unsigned> {tok_id});
+// Sorts sample IDs by source lengths, and then target lengths.
+inline void sort_by_length(
+    const primitiv_nmt::proto::Corpus &corpus, std::vector<unsigned> &ids) {
+  std::sort(ids.begin(), ids.end(), [&](unsigned a, unsigned b) {
+      const auto &sa = corpus.samples()[a];
+      const auto &sb = corpus.samples()[b];
+      const unsigned sa_src = sa.source().token_ids_size();
+      const unsigned sb_src = sb.source().token_ids_size();
+      const unsigned sa_trg = sa.target().token_ids_size();
+      const unsigned sb_trg = sb.target().token_ids_size();
+      if (sa_src == sb_src) return sa_trg < sb_trg;
+      else return sa_src < sb_src;
+  });
+}
+
+// Splits sorted sample IDs into ranges of at most `batch_size` samples with
+// the same source/target lengths. If `max_tokens` is not 0, each range also
+// has at most `max_tokens` source and target tokens in total (but at least
+// one sample), so that batches of long samples become smaller.
+inline std::vector<std::pair<unsigned, unsigned>> make_batch_ranges(
+    const primitiv_nmt::proto::Corpus &corpus,
+    const std::vector<unsigned> &ids,
+    unsigned batch_size, unsigned max_tokens = 0) {
+  std::vector<std::pair<unsigned, unsigned>> ranges;
+  const unsigned num_total_samples = ids.size();
+  unsigned left = 0;
+  while (left < num_total_samples) {
+    const auto &left_sample = corpus.samples()[ids[left]];
+    const unsigned left_src = left_sample.source().token_ids_size();
+    const unsigned left_trg = left_sample.target().token_ids_size();
+    unsigned right = left + 1;
+    while (right < num_total_samples) {
+      const auto &right_sample = corpus.samples()[ids[right]];
+      const unsigned right_src = right_sample.source().token_ids_size();
+      const unsigned right_trg = right_sample.target().token_ids_size();
+      if (right_src != left_src || right_trg != left_trg) break;
+      ++right;
     }
-    batch.target.reserve(sample.target().token_ids_size());
-    for (const unsigned tok_id : sample.target().token_ids()) {
-      batch.target.emplace_back(std::vector<unsigned> {tok_id});
+    unsigned bs = batch_size;
+    if (max_tokens > 0) {
+      bs = std::min(bs, std::max(1u, max_tokens / (left_src + left_trg)));
     }
-    ++pos_;
-    return batch;
+    const unsigned num_sents = right - left;
+    const unsigned num_batches = (num_sents + bs - 1) / bs;
+    const unsigned num_sents_per_batch = num_sents / num_batches;
+    const unsigned carry = num_sents % num_batches;
+    unsigned first = left;
+    for (unsigned i = 0; i < num_batches; ++i) {
+      const unsigned second = first + num_sents_per_batch + (i < carry);
+      ranges.emplace_back(first, second);
+      first = second;
+    }
+    left = right;
   }
-
-  bool has_next() const override {
-    return pos_ < static_cast<unsigned>(corpus_.samples_size());
+  return ranges;
+}
+
+// Makes a batch from samples ids[first], ..., ids[second - 1], which should
+// have the same source/target lengths.
+inline Batch make_batch(
+    const primitiv_nmt::proto::Corpus &corpus,
+    const std::vector<unsigned> &ids,
+    unsigned first, unsigned second) {
+  const unsigned batch_size = second - first;
+  const auto &first_sample = corpus.samples()[ids[first]];
+  const unsigned src_len = first_sample.source().token_ids_size();
+  const unsigned trg_len = first_sample.target().token_ids_size();
+  Batch batch {
+    std::vector<std::vector<unsigned>>(
+        src_len, std::vector<unsigned>(batch_size)),
+    std::vector<std::vector<unsigned>>(
+        trg_len, std::vector<unsigned>(batch_size)),
+  };
+  for (unsigned i = 0; i < batch_size; ++i) {
+    const auto &sample = corpus.samples()[ids[i + first]];
+    const auto &src_token_ids = sample.source().token_ids();
+    for (unsigned j = 0; j < src_len; ++j) {
+      batch.source[j][i] = src_token_ids[j];
+    }
+    const auto &trg_token_ids = sample.target().token_ids();
+    for (unsigned j = 0; j < trg_len; ++j) {
+      batch.target[j][i] = trg_token_ids[j];
+    }
   }
-
-  unsigned num_sentences() const override { return corpus_.samples_size(); }
-};
+  return batch;
+}
 
 class RandomBatchSampler : public Sampler {
   const primitiv_nmt::proto::Corpus &corpus_;
   unsigned bs_;
+  unsigned max_tokens_;
   std::mt19937 rng_;
   std::vector<unsigned> ids_;
   std::vector<std::pair<unsigned, unsigned>> ranges_;
@@ -74,9 +133,11 @@ class RandomBatchSampler : public Sampler {
 
 public:
   RandomBatchSampler(
-      const primitiv_nmt::proto::Corpus &corpus, unsigned batch_size, unsigned seed)
+      const primitiv_nmt::proto::Corpus &corpus, unsigned batch_size, unsigned seed,
+      unsigned max_tokens = 0)
     : corpus_(corpus)
     , bs_(batch_size)
+    , max_tokens_(max_tokens)
     , rng_(seed)
     , ids_(corpus.samples_size())
     , pos_(0) {
@@ -84,80 +145,93 @@ public:
     }
 
   void reset() override {
-    ranges_.clear();
     std::shuffle(ids_.begin(), ids_.end(), rng_);
-    std::sort(ids_.begin(), ids_.end(), [&](unsigned a, unsigned b) {
-        const auto &sa = corpus_.samples()[a];
-        const auto &sb = corpus_.samples()[b];
-        const unsigned sa_src = sa.source().token_ids_size();
-        const unsigned sb_src = sb.source().token_ids_size();
-        const unsigned sa_trg = sa.target().token_ids_size();
-        const unsigned sb_trg = sb.target().token_ids_size();
-        if (sa_src == sb_src) return sa_trg < sb_trg;
-        else return sa_src < sb_src;
-    });
-    const unsigned num_total_samples = corpus_.samples_size();
-    unsigned left = 0;
-    while (left < num_total_samples) {
-      const auto &left_sample = corpus_.samples()[ids_[left]];
-      const unsigned left_src = left_sample.source().token_ids_size();
-      const unsigned left_trg = left_sample.target().token_ids_size();
-      unsigned right = left + 1;
-      while (right < num_total_samples) {
-        const auto &right_sample = corpus_.samples()[ids_[right]];
-        const unsigned right_src = right_sample.source().token_ids_size();
-        const unsigned right_trg = right_sample.target().token_ids_size();
-        if (right_src != left_src || right_trg != left_trg) break;
-        ++right;
-      }
-      const unsigned num_sents = right - left;
-      const unsigned num_batches = (num_sents + bs_ - 1) / bs_;
-      const unsigned num_sents_per_batch = num_sents / num_batches;
-      const unsigned carry = num_sents % num_batches;
-      unsigned first = left;
-      for (unsigned i = 0; i < num_batches; ++i) {
-        const unsigned second = first + num_sents_per_batch + (i < carry);
-        ranges_.emplace_back(first, second);
-        first = second;
-      }
-      left = right;
-    }
+    ::sort_by_length(corpus_, ids_);
+    ranges_ = ::make_batch_ranges(corpus_, ids_, bs_, max_tokens_);
     std::shuffle(ranges_.begin(), ranges_.end(), rng_);
     pos_ = 0;
   }
 
   Batch next() override {
     if (!has_next()) throw std::runtime_error("No next batch.");
-    const unsigned first = ranges_[pos_].first;
-    const unsigned second = ranges_[pos_].second;
-    const unsigned batch_size = second - first;
-    const auto &first_sample = corpus_.samples()[ids_[first]];
-    const unsigned src_len = first_sample.source().token_ids_size();
-    const unsigned trg_len = first_sample.target().token_ids_size();
-    Batch batch {
-      std::vector<std::vector<unsigned>>(
-          src_len, std::vector<unsigned>(batch_size)),
-      std::vector<std::vector<unsigned>>(
-          trg_len, std::vector<unsigned>(batch_size)),
-    };
-    for (unsigned i = 0; i < batch_size; ++i) {
-      const auto &sample = corpus_.samples()[ids_[i + first]];
-      const auto &src_token_ids = sample.source().token_ids();
-      for (unsigned j = 0; j < src_len; ++j) {
-        batch.source[j][i] = src_token_ids[j];
-      }
-      const auto &trg_token_ids = sample.target().token_ids();
-      for (unsigned j = 0; j < trg_len; ++j) {
-        batch.target[j][i] = trg_token_ids[j];
-      }
+    const auto &range = ranges_[pos_++];
+    return ::make_batch(corpus_, ids_, range.first, range.second);
+  }
+
+  bool has_next() const override { return pos_ < ranges_.size(); }
+
+  unsigned num_sentences() const override { return corpus_.samples_size(); }
+
+  void get_state(primitiv_nmt::proto::SamplerState &state) const override {
+    state.Clear();
+    std::ostringstream rng;
+    rng << rng_;
+    state.set_rng(rng.str());
+    for (const unsigned id : ids_) state.add_ids(id);
+    for (const auto &range : ranges_) {
+      state.add_range_firsts(range.first);
+      state.add_range_seconds(range.second);
     }
-    ++pos_;
-    return batch;
+    state.set_position(pos_);
+  }
+
+  void set_state(const primitiv_nmt::proto::SamplerState &state) override {
+    if (static_cast<unsigned>(state.ids_size()) != ids_.size()) {
+      throw std::runtime_error("Sampler state does not match the corpus.");
+    }
+    std::istringstream rng(state.rng());
+    rng >> rng_;
+    ids_.assign(state.ids().begin(), state.ids().end());
+    ranges_.clear();
+    for (int i = 0; i < state.range_firsts_size(); ++i) {
+      ranges_.emplace_back(state.range_firsts(i), state.range_seconds(i));
+    }
+    pos_ = state.position();
+  }
+};
+
+// Deterministic sampler which makes batches of samples with the same lengths.
+// Batches are always yielded in the same order, from shorter samples.
+class SortedBatchSampler : public Sampler {
+  const primitiv_nmt::proto::Corpus &corpus_;
+  std::vector<unsigned> ids_;
+  std::vector<std::pair<unsigned, unsigned>> ranges_;
+  unsigned pos_;
+
+  SortedBatchSampler(const SortedBatchSampler &) = delete;
+  SortedBatchSampler &operator=(const SortedBatchSampler &) = delete;
+
+public:
+  SortedBatchSampler(
+      const primitiv_nmt::proto::Corpus &corpus, unsigned batch_size)
+    : corpus_(corpus)
+    , ids_(corpus.samples_size())
+    , pos_(0) {
+      std::iota(ids_.begin(), ids_.end(), 0);
+      ::sort_by_length(corpus_, ids_);
+      ranges_ = ::make_batch_ranges(corpus_, ids_, batch_size);
+    }
+
+  void reset() override { pos_ = 0; }
+
+  Batch next() override {
+    if (!has_next()) throw std::runtime_error("No next batch.");
+    const auto &range = ranges_[pos_++];
+    return ::make_batch(corpus_, ids_, range.first, range.second);
   }
 
   bool has_next() const override { return pos_ < ranges_.size(); }
 
   unsigned num_sentences() const override { return corpus_.samples_size(); }
+
+  void get_state(primitiv_nmt::proto::SamplerState &state) const override {
+    state.Clear();
+    state.set_position(pos_);
+  }
+
+  void set_state(const primitiv_nmt::proto::SamplerState &state) override {
+    pos_ = state.position();
+  }
 };
 
 #endif  // PRIMITIV_NMT_SAMPLER_H_
@@ -0,0 +1,231 @@
+#include <primitiv_nmt/config.h>
+
+#include <atomic>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <primitiv/primitiv.h>
+
+#include <primitiv_nmt/bpe.h>
+#include <primitiv_nmt/compressed_model.h>
+#include <primitiv_nmt/cpu_affinity.h>
+#include <primitiv_nmt/data_parallel.h>
+#include <primitiv_nmt/encoder_decoder.h>
+#include <primitiv_nmt/primitiv_nmt.pb.h>
+#include <primitiv_nmt/sampler.h>
+#include <primitiv_nmt/utils.h>
+#include <primitiv_nmt/vocabulary.h>
+
+using namespace std;
+
+// Reads at most `max_pairs` sentence pairs into `corpus`, either from two
+// parallel files or tab-separated lines of `src_is`. Returns false if no
+// pairs remain.
+bool read_pairs(
+    istream &src_is, istream *trg_is, unsigned max_pairs,
+    const ::Vocabulary &src_vocab, const ::Vocabulary &trg_vocab,
+    const ::BPE *src_bpe, const ::BPE *trg_bpe, unsigned num_threads,
+    vector<::BPECache> &src_caches, vector<::BPECache> &trg_caches,
+    primitiv_nmt::proto::Corpus &corpus) {
+  vector<string> src_lines, trg_lines;
+  if (trg_is) {
+    if (!::read_lines(src_is, max_pairs, src_lines)) return false;
+    ::read_lines(*trg_is, src_lines.size(), trg_lines);
+    if (trg_lines.size() != src_lines.size()) {
+      throw runtime_error("Numbers of source/target lines mismatched.");
+    }
+  } else {
+    if (!::read_lines(src_is, max_pairs, src_lines)) return false;
+    for (string &line : src_lines) {
+      const size_t tab = line.find('\t');
+      if (tab == string::npos) {
+        throw runtime_error("No tab in the line: " + line);
+      }
+      trg_lines.emplace_back(line.substr(tab + 1));
+      line.resize(tab);
+    }
+  }
+  if (src_bpe) src_bpe->encode_lines(src_lines, src_caches, num_threads);
+  if (trg_bpe) trg_bpe->encode_lines(trg_lines, trg_caches, num_threads);
+
+  corpus.Clear();
+  for (unsigned i = 0; i < src_lines.size(); ++i) {
+    primitiv_nmt::proto::Sample *sample = corpus.add_samples();
+    primitiv_nmt::proto::Sentence *source = sample->mutable_source();
+    for (unsigned id : src_vocab.line_to_ids(
+          "<bos> " + src_lines[i] + " <eos>")) {
+      source->add_token_ids(id);
+    }
+    primitiv_nmt::proto::Sentence *target = sample->mutable_target();
+    for (unsigned id : trg_vocab.line_to_ids(
+          "<bos> " + trg_lines[i] + " <eos>")) {
+      target->add_token_ids(id);
+    }
+  }
+  return true;
+}
+
+// Calculates log probabilities of target words of all samples using all
+// models in parallel. Samples with the same lengths are batched together.
+vector<vector<float>> score_corpus(
+    const primitiv_nmt::proto::Corpus &corpus, unsigned batch_size,
+    vector<unique_ptr<::EncoderDecoder<primitiv::Tensor>>> &models) {
+  vector<unsigned> ids(corpus.samples_size());
+  for (unsigned i = 0; i < ids.size(); ++i) ids[i] = i;
+  ::sort_by_length(corpus, ids);
+  const auto ranges = ::make_batch_ranges(corpus, ids, batch_size);
+
+  vector<vector<float>> scores(ids.size());
+  atomic<unsigned> next(0);
+  ::parallel_for(models.size(), [&](unsigned t) {
+      while (true) {
+        const unsigned r = next++;
+        if (r >= ranges.size()) break;
+        const unsigned first = ranges[r].first;
+        const unsigned last = ranges[r].second;
+        const Batch batch = ::make_batch(corpus, ids, first, last);
+        models[t]->encode(batch.source);
+        models[t]->init_decoder();
+        const vector<float> losses =
+          models[t]->token_losses(batch.target).to_vector();
+        const unsigned num_words = batch.target.size() - 1;
+        for (unsigned i = first; i < last; ++i) {
+          vector<float> &ret = scores[ids[i]];
+          const unsigned offset = (i - first) * num_words;
+          for (unsigned j = 0; j < num_words; ++j) {
+            ret.emplace_back(-losses[offset + j]);
+          }
+        }
+      }
+  });
+  return scores;
+}
+
+int main(int argc, char *argv[]) {
+  const auto opts = ::check_args(argc, argv, {
+      "(file/in) Source vocabulary file",
+      "(file/in) Target vocabulary file",
+      "(dir/in) Model directory",
+      "(int) Epoch",
+#ifdef PRIMITIV_NMT_USE_CUDA
+      "(int) GPU ID",
+#endif
+  }, {
+      {"config", "",
+        "(file/in) Config file of default option values, e.g., written by "
+        "autotune"},
+      {"src", "",
+        "(file/in) Source sentences (default: tab-separated pairs in stdin)"},
+      {"trg", "", "(file/in) Target sentences parallel to --src"},
+      {"corpus", "", "(file/in) Corpus file made by make_corpus"},
+      {"src-bpe", "", "(file/in) BPE model file applied to source sentences"},
+      {"trg-bpe", "", "(file/in) BPE model file applied to target sentences"},
+      {"batch", "64", "(int) Maximum number of sentences in a batch"},
+      {"chunk", "100000", "(int) Number of pairs read at once"},
+#ifndef PRIMITIV_NMT_USE_CUDA
+      {"threads", "1",
+        "(int) Number of threads, each with its own model (0: all cores)"},
+      {"intra-threads", "0",
+        "(int) Number of threads used by each tensor operation "
+        "(0: OpenMP default)"},
+      {"cpus", "", "(str) Pins the process to CPUs, e.g., 0-7,16-23"},
+      {"numa-node", "-1",
+        "(int) Runs the process and allocates its memory on the NUMA node "
+        "(-1: disabled)"},
+#endif
+      {"tokens", "0", "(0/1) Also prints log probabilities of each word"},
+  });
+
+  ::global_try_block([&]() {
+      const string src_vocab_file = *++argv;
+      const string trg_vocab_file = *++argv;
+      const string model_dir = *++argv;
+      const unsigned epoch = stoi(*++argv);
+#ifdef PRIMITIV_NMT_USE_CUDA
+      const unsigned gpu_id = stoi(*++argv);
+      const unsigned num_threads = 1;
+#else
+      const unsigned num_threads = ::get_num_threads(stoi(opts.at("threads")));
+      ::apply_cpu_options(opts);
+#endif
+      const unsigned batch_size = stoi(opts.at("batch"));
+      const unsigned chunk_size = stoi(opts.at("chunk"));
+      const bool with_tokens = stoi(opts.at("tokens"));
+
+      const string subdir = ::get_model_dir(model_dir, epoch);
+      const ::Vocabulary src_vocab(src_vocab_file);
+      const ::Vocabulary trg_vocab(trg_vocab_file);
+
+      vector<unique_ptr<primitiv::Device>> devs;
+      vector<unique_ptr<::EncoderDecoder<primitiv::Tensor>>> models;
+      for (unsigned i = 0; i < num_threads; ++i) {
+#ifdef PRIMITIV_NMT_USE_CUDA
+        devs.emplace_back(new primitiv::devices::CUDA(gpu_id));
+#else
+        devs.emplace_back(new primitiv::devices::Eigen());
+#endif
+        primitiv::Device::set_default(*devs.back());
+        models.emplace_back(new ::EncoderDecoder<primitiv::Tensor>(
+              ::load_model_config(model_dir)));
+        ::load_checkpoint_model(*models.back(), subdir, false);
+      }
+      primitiv::Device::set_default(*devs[0]);
+
+      const auto print_scores = [&](const vector<vector<float>> &scores) {
+        for (const vector<float> &words : scores) {
+          float sum = 0;
+          for (float s : words) sum += s;
+          cout << sum;
+          if (with_tokens) {
+            cout << '\t';
+            for (unsigned j = 0; j < words.size(); ++j) {
+              cout << (j > 0 ? " " : "") << words[j];
+            }
+          }
+          cout << '\n';
+        }
+        cout << flush;
+      };
+
+      if (!opts.at("corpus").empty()) {
+        primitiv_nmt::proto::Corpus corpus;
+        ::load_proto(opts.at("corpus"), corpus);
+        print_scores(::score_corpus(corpus, batch_size, models));
+        return;
+      }
+
+      unique_ptr<::BPE> src_bpe, trg_bpe;
+      if (!opts.at("src-bpe").empty()) {
+        src_bpe.reset(new ::BPE(opts.at("src-bpe")));
+      }
+      if (!opts.at("trg-bpe").empty()) {
+        trg_bpe.reset(new ::BPE(opts.at("trg-bpe")));
+      }
+      vector<::BPECache> src_caches(num_threads), trg_caches(num_threads);
+
+      ifstream src_ifs, trg_ifs;
+      if (!opts.at("src").empty()) {
+        if (opts.at("trg").empty()) {
+          throw runtime_error("--trg is required with --src.");
+        }
+        ::open_file(opts.at("src"), src_ifs);
+        ::open_file(opts.at("trg"), trg_ifs);
+      }
+      istream &src_is = src_ifs.is_open() ? src_ifs : cin;
+      istream *trg_is = trg_ifs.is_open() ? &trg_ifs : nullptr;
+
+      primitiv_nmt::proto::Corpus corpus;
+      while (::read_pairs(
+            src_is, trg_is, chunk_size, src_vocab, trg_vocab,
+            src_bpe.get(), trg_bpe.get(), num_threads,
+            src_caches, trg_caches, corpus)) {
+        print_scores(::score_corpus(corpus, batch_size, models));
+      }
+  });
+
+  return 0;
+}
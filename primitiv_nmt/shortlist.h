@@ -0,0 +1,68 @@
+#ifndef PRIMITIV_NMT_SHORTLIST_H_
+#define PRIMITIV_NMT_SHORTLIST_H_
+
+#include <algorithm>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include <primitiv_nmt/primitiv_nmt.pb.h>
+#include <primitiv_nmt/utils.h>
+#include <primitiv_nmt/vocabulary.h>
+
+// Lexical shortlist of target words used in decoding.
+// The shortlist of a source batch consists of the most frequent target words,
+// <unk>, <eos>, and translation candidates of all source words in the batch.
+class Shortlist {
+  std::vector<unsigned> frequent_ids_;
+  std::vector<std::vector<unsigned>> candidates_;
+  unsigned trg_vocab_size_;
+
+  Shortlist(const Shortlist &) = delete;
+  Shortlist &operator=(const Shortlist &) = delete;
+
+public:
+  Shortlist(
+      const std::string &path, const ::Vocabulary &trg_vocab,
+      unsigned num_frequent)
+    : trg_vocab_size_(trg_vocab.size()) {
+    primitiv_nmt::proto::Shortlist data;
+    ::load_proto(path, data);
+    for (const auto &entry : data.entries()) {
+      candidates_.emplace_back(
+          entry.token_ids().begin(), entry.token_ids().end());
+    }
+
+    std::vector<unsigned> ids(trg_vocab_size_);
+    std::iota(ids.begin(), ids.end(), 0);
+    std::stable_sort(ids.begin(), ids.end(), [&](unsigned a, unsigned b) {
+        return trg_vocab.freq(a) > trg_vocab.freq(b);
+    });
+    ids.resize(std::min(num_frequent, trg_vocab_size_));
+    ids.emplace_back(trg_vocab.stoi("<unk>"));
+    ids.emplace_back(trg_vocab.stoi("<eos>"));
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    frequent_ids_ = std::move(ids);
+  }
+
+  // Returns sorted target word IDs for the source batch.
+  std::vector<unsigned> get(
+      const std::vector<std::vector<unsigned>> &src_batch) const {
+    std::vector<bool> used(trg_vocab_size_, false);
+    for (const unsigned id : frequent_ids_) used[id] = true;
+    for (const auto &ids : src_batch) {
+      for (const unsigned src_id : ids) {
+        if (src_id >= candidates_.size()) continue;
+        for (const unsigned id : candidates_[src_id]) used[id] = true;
+      }
+    }
+    std::vector<unsigned> ret;
+    for (unsigned i = 0; i < trg_vocab_size_; ++i) {
+      if (used[i]) ret.emplace_back(i);
+    }
+    return ret;
+  }
+};
+
+#endif  // PRIMITIV_NMT_SHORTLIST_H_
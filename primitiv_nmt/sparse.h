@@ -0,0 +1,181 @@
+#ifndef PRIMITIV_NMT_SPARSE_H_
+#define PRIMITIV_NMT_SPARSE_H_
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <primitiv/primitiv.h>
+
+// Matrix in the block compressed sparse row (BSR) format.
+// The matrix is split into blocks of block_rows x block_cols elements, and
+// only blocks with any non-zero elements are stored.
+class BlockSparseMatrix {
+  unsigned rows_, cols_;
+  unsigned block_rows_, block_cols_;
+  std::vector<unsigned> row_ptrs_;  // {#block rows + 1}
+  std::vector<unsigned> col_ids_;  // {#blocks}
+  std::vector<float> values_;  // Row-major elements of each block.
+
+public:
+  // Makes the matrix from column-major elements of a {rows, cols} matrix.
+  BlockSparseMatrix(
+      const std::vector<float> &dense, unsigned rows, unsigned cols,
+      unsigned block_rows, unsigned block_cols)
+    : rows_(rows), cols_(cols)
+    , block_rows_(block_rows), block_cols_(block_cols) {
+    if (block_rows == 0 || block_cols == 0) {
+      throw std::runtime_error("Block size should be >= 1.");
+    }
+    if (dense.size() != rows * cols) {
+      throw std::runtime_error("Invalid size of the dense matrix.");
+    }
+    const unsigned num_brows = (rows + block_rows - 1) / block_rows;
+    const unsigned num_bcols = (cols + block_cols - 1) / block_cols;
+    row_ptrs_.emplace_back(0);
+    for (unsigned br = 0; br < num_brows; ++br) {
+      for (unsigned bc = 0; bc < num_bcols; ++bc) {
+        std::vector<float> block(block_rows * block_cols, 0);
+        bool nonzero = false;
+        for (unsigned i = 0; i < block_rows; ++i) {
+          const unsigned r = br * block_rows + i;
+          if (r >= rows) break;
+          for (unsigned j = 0; j < block_cols; ++j) {
+            const unsigned c = bc * block_cols + j;
+            if (c >= cols) break;
+            const float v = dense[c * rows + r];
+            block[i * block_cols + j] = v;
+            if (v != 0) nonzero = true;
+          }
+        }
+        if (nonzero) {
+          col_ids_.emplace_back(bc);
+          values_.insert(values_.end(), block.begin(), block.end());
+        }
+      }
+      row_ptrs_.emplace_back(col_ids_.size());
+    }
+  }
+
+  // Calculates W . X, where X is {cols, n} and the result is {rows, n}.
+  // Both are column-major.
+  std::vector<float> multiply(const std::vector<float> &x, unsigned n) const {
+    std::vector<float> y(rows_ * n, 0);
+    const unsigned block_size = block_rows_ * block_cols_;
+    for (unsigned k = 0; k < n; ++k) {
+      const float *xk = x.data() + k * cols_;
+      float *yk = y.data() + k * rows_;
+      for (unsigned br = 0; br + 1 < row_ptrs_.size(); ++br) {
+        const unsigned r0 = br * block_rows_;
+        const unsigned nr = std::min(block_rows_, rows_ - r0);
+        for (unsigned p = row_ptrs_[br]; p < row_ptrs_[br + 1]; ++p) {
+          const unsigned c0 = col_ids_[p] * block_cols_;
+          const unsigned nc = std::min(block_cols_, cols_ - c0);
+          const float *block = values_.data() + p * block_size;
+          for (unsigned i = 0; i < nr; ++i) {
+            const float *w = block + i * block_cols_;
+            float sum = 0;
+            for (unsigned j = 0; j < nc; ++j) sum += w[j] * xk[c0 + j];
+            yk[r0 + i] += sum;
+          }
+        }
+      }
+    }
+    return y;
+  }
+
+  // Ratio of zero blocks.
+  float sparsity() const {
+    const unsigned num_blocks = (row_ptrs_.size() - 1)
+      * ((cols_ + block_cols_ - 1) / block_cols_);
+    return 1.f - static_cast<float>(col_ids_.size()) / num_blocks;
+  }
+
+  unsigned rows() const { return rows_; }
+  unsigned cols() const { return cols_; }
+};
+
+// Makes a sparse copy of the matrix parameter if at least `min_sparsity` of
+// its blocks are zero, otherwise nullptr.
+inline std::shared_ptr<::BlockSparseMatrix> make_sparse_matrix(
+    const primitiv::Parameter &param, float min_sparsity,
+    unsigned block_rows, unsigned block_cols) {
+  const primitiv::Shape &shape = param.shape();
+  std::shared_ptr<::BlockSparseMatrix> ret(new ::BlockSparseMatrix(
+        param.value().to_vector(), shape[0], shape[1],
+        block_rows, block_cols));
+  if (ret->sparsity() < min_sparsity) ret.reset();
+  return ret;
+}
+
+// Calculates w . x, using the sparse kernel if `sparse` is not nullptr.
+// The sparse kernel runs on the host memory and is used only for inference.
+template<typename Var>
+inline Var sparse_matmul(
+    const Var &w, const ::BlockSparseMatrix *sparse, const Var &x) {
+  namespace F = primitiv::functions;
+  if (!sparse) return F::matmul(w, x);
+  const primitiv::Shape &shape = x.shape();
+  const unsigned n = shape.volume() / sparse->cols() * shape.batch();
+  return F::input<Var>(
+      primitiv::Shape({sparse->rows(), n / shape.batch()}, shape.batch()),
+      sparse->multiply(x.to_vector(), n), x.device());
+}
+
+// Parses the block size written as "<rows>x<cols>", e.g., "4x4".
+inline std::pair<unsigned, unsigned> parse_block_size(const std::string &str) {
+  const std::size_t pos = str.find('x');
+  if (pos == std::string::npos) {
+    throw std::runtime_error("Invalid block size: " + str);
+  }
+  const int rows = std::stoi(str.substr(0, pos));
+  const int cols = std::stoi(str.substr(pos + 1));
+  if (rows <= 0 || cols <= 0) {
+    throw std::runtime_error("Invalid block size: " + str);
+  }
+  return std::make_pair(rows, cols);
+}
+
+// Zeros the blocks with the smallest L2 norms in the column-major
+// {rows, cols} matrix, so that the ratio `sparsity` of all blocks are zero.
+inline void prune_blocks(
+    std::vector<float> &dense, unsigned rows, unsigned cols,
+    float sparsity, unsigned block_rows, unsigned block_cols) {
+  const unsigned num_brows = (rows + block_rows - 1) / block_rows;
+  const unsigned num_bcols = (cols + block_cols - 1) / block_cols;
+  std::vector<std::pair<float, unsigned>> norms;
+  for (unsigned br = 0; br < num_brows; ++br) {
+    for (unsigned bc = 0; bc < num_bcols; ++bc) {
+      float sq_norm = 0;
+      for (unsigned r = br * block_rows;
+          r < std::min(rows, (br + 1) * block_rows); ++r) {
+        for (unsigned c = bc * block_cols;
+            c < std::min(cols, (bc + 1) * block_cols); ++c) {
+          sq_norm += dense[c * rows + r] * dense[c * rows + r];
+        }
+      }
+      norms.emplace_back(sq_norm, br * num_bcols + bc);
+    }
+  }
+
+  const unsigned num_pruned = std::min<unsigned>(
+      norms.size(), sparsity * norms.size() + 0.5f);
+  std::nth_element(
+      norms.begin(), norms.begin() + num_pruned, norms.end());
+  for (unsigned i = 0; i < num_pruned; ++i) {
+    const unsigned br = norms[i].second / num_bcols;
+    const unsigned bc = norms[i].second % num_bcols;
+    for (unsigned r = br * block_rows;
+        r < std::min(rows, (br + 1) * block_rows); ++r) {
+      for (unsigned c = bc * block_cols;
+          c < std::min(cols, (bc + 1) * block_cols); ++c) {
+        dense[c * rows + r] = 0;
+      }
+    }
+  }
+}
+
+#endif  // PRIMITIV_NMT_SPARSE_H_
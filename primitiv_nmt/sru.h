@@ -0,0 +1,87 @@
+#ifndef PRIMITIV_NMT_SRU_H_
+#define PRIMITIV_NMT_SRU_H_
+
+#include <memory>
+
+#include <primitiv/primitiv.h>
+
+#include <primitiv_nmt/recurrent_cell.h>
+#include <primitiv_nmt/sparse.h>
+
+// Simple recurrent unit (Lei et al., 2018) with a projected highway
+// connection. All matrix multiplications depend only on inputs, hence
+// RecurrentCell::forward_sequence() runs them at once.
+// Formulation:
+//   z = W_xz . x[t] + b_z
+//   f = sigmoid(W_xf . x[t] + b_f)
+//   r = sigmoid(W_xr . x[t] + b_r)
+//   s = W_xs . x[t] + b_s
+//   c[t] = f * c[t-1] + (1 - f) * z
+//   h[t] = r * tanh(c[t]) + (1 - r) * s
+template<typename Var>
+class SRU : public ::RecurrentCell<Var> {
+  primitiv::Parameter pwxh_, pbh_;
+  Var wxh_, bh_, h_, c_;
+  std::shared_ptr<::BlockSparseMatrix> swxh_;
+
+public:
+  // New model.
+  SRU() {
+    this->add("wxh", pwxh_);
+    this->add("bh", pbh_);
+  }
+
+  void init(unsigned input_size, unsigned output_size) override {
+    namespace I = primitiv::initializers;
+    pwxh_.init({4 * output_size, input_size}, I::Uniform(-0.1, 0.1));
+    pbh_.init({4 * output_size}, I::Constant(0));
+  }
+
+  void reset(const Var &init_c, const Var &init_h) override {
+    namespace F = primitiv::functions;
+    wxh_ = F::parameter<Var>(pwxh_);
+    bh_ = F::parameter<Var>(pbh_);
+    c_ = init_c.valid()
+      ? init_c : F::zeros<Var>({output_size()}, pbh_.device());
+    h_ = init_h.valid() ? init_h : F::tanh(c_);
+  }
+
+  Var forward(const Var &x) override {
+    return forward_projected(project(x) + bh_);
+  }
+
+  Var forward_projected(const Var &wxb) override {
+    namespace F = primitiv::functions;
+    const unsigned no = output_size();
+    const Var z = F::slice(wxb, 0, 0, no);
+    const Var f = F::sigmoid(F::slice(wxb, 0, no, 2 * no));
+    const Var r = F::sigmoid(F::slice(wxb, 0, 2 * no, 3 * no));
+    const Var s = F::slice(wxb, 0, 3 * no, 4 * no);
+    c_ = f * c_ + (1 - f) * z;
+    h_ = r * F::tanh(c_) + (1 - r) * s;
+    return h_;
+  }
+
+  Var get_wx(unsigned lower, unsigned upper) override {
+    namespace F = primitiv::functions;
+    return F::slice(F::parameter<Var>(pwxh_), 1, lower, upper);
+  }
+  Var get_b() override { return primitiv::functions::parameter<Var>(pbh_); }
+
+  Var project(const Var &xs) override {
+    return ::sparse_matmul(wxh_, swxh_.get(), xs);
+  }
+
+  void make_sparse(
+      float min_sparsity, unsigned block_rows, unsigned block_cols) override {
+    swxh_ = ::make_sparse_matrix(pwxh_, min_sparsity, block_rows, block_cols);
+  }
+
+  Var get_c() const override { return c_; }
+  Var get_h() const override { return h_; }
+
+  unsigned input_size() const override { return pwxh_.shape()[1]; }
+  unsigned output_size() const override { return pwxh_.shape()[0] / 4; }
+};
+
+#endif  // PRIMITIV_NMT_SRU_H_
@@ -1,13 +1,18 @@
 #include <primitiv_nmt/config.h>
 
 #include <iostream>
+#include <memory>
 #include <random>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
 #include <primitiv/primitiv.h>
 
+#include <primitiv_nmt/cpu_affinity.h>
+#include <primitiv_nmt/distributed.h>
 #include <primitiv_nmt/encoder_decoder.h>
+#include <primitiv_nmt/lazy_adam.h>
 #include <primitiv_nmt/nmt_utils.h>
 #include <primitiv_nmt/lstm.h>
 #include <primitiv_nmt/primitiv_nmt.pb.h>
@@ -16,7 +21,7 @@
 #include <primitiv_nmt/vocabulary.h>
 
 int main(int argc, char *argv[]) {
-  ::check_args(argc, argv, {
+  const auto opts = ::check_args(argc, argv, {
       "(file/in) Train corpus file",
       "(file/in) Dev corpus file",
       "(file/in) Source vocabulary file",
@@ -30,6 +35,53 @@ int main(int argc, char *argv[]) {
 #ifdef PRIMITIV_NMT_USE_CUDA
       "(int) GPU ID",
 #endif
+  }, {
+      {"config", "",
+        "(file/in) Config file of default option values, e.g., written by "
+        "autotune"},
+      {"workers", "1", "(int) Number of data-parallel worker threads"},
+#ifndef PRIMITIV_NMT_USE_CUDA
+      {"intra-threads", "0",
+        "(int) Number of threads used by each tensor operation "
+        "(0: OpenMP default)"},
+      {"cpus", "", "(str) Pins the process to CPUs, e.g., 0-7,16-23"},
+      {"numa-node", "-1",
+        "(int) Runs the process and allocates its memory on the NUMA node "
+        "(-1: disabled)"},
+#endif
+      {"max-batch-tokens", "0",
+        "(int) Max number of source and target tokens in a batch "
+        "(0: no limit)"},
+      {"hogwild", "0", "(0/1) Lock-free asynchronous updates by workers"},
+      {"rank", "0", "(int) Rank of this process"},
+      {"world-size", "1", "(int) Number of processes"},
+      {"hosts", "localhost:21000",
+        "(str) Comma-separated host:port of all ranks, or base host:port"},
+      {"checkpoint-steps", "0",
+        "(int) Saves a checkpoint every N steps (0: disabled)"},
+      {"keep-checkpoints", "0",
+        "(int) Keeps only the latest N checkpoints and the best one "
+        "(0: all)"},
+      {"latest-optimizer-only", "0",
+        "(0/1) Keeps optimizer statistics only in the latest checkpoint"},
+      {"compress-checkpoints", "0", "(0/1) Compresses parameter files"},
+      {"sampled-softmax", "0",
+        "(int) Number of negative samples per batch (0: full softmax)"},
+      {"seed", "",
+        "(int) Seed of batch and negative sampling (empty: random)"},
+      {"recompute-segment", "0",
+        "(int) Recomputes decoder activations in segments of N steps during "
+        "backward to save memory (0: disabled)"},
+      {"lazy-adam", "0",
+        "(0/1) Updates only embeddings of words in each batch"},
+      {"cell", "lstm", "(lstm/sru) Recurrent cell of encoder and decoder"},
+      {"attention-window", "0",
+        "(int) Window size D of local attention (0: global attention)"},
+      {"tie-embedding", "0",
+        "(0/1) Shares the target embedding with the output layer"},
+      {"adaptive-softmax", "",
+        "(str) Comma-separated cluster cutoffs of adaptive softmax "
+        "(empty: full softmax)"},
   });
 
   ::global_try_block([&]() {
@@ -46,11 +98,53 @@ int main(int argc, char *argv[]) {
 #ifdef PRIMITIV_NMT_USE_CUDA
       const unsigned gpu_id = std::stoi(*++argv);
 #endif
+      const unsigned num_workers = std::stoi(opts.at("workers"));
+      const unsigned max_tokens = std::stoi(opts.at("max-batch-tokens"));
+      const bool hogwild = std::stoi(opts.at("hogwild"));
+      const unsigned rank = std::stoi(opts.at("rank"));
+      const unsigned world_size = std::stoi(opts.at("world-size"));
+      const unsigned checkpoint_steps = std::stoi(opts.at("checkpoint-steps"));
+      const unsigned num_keeps = std::stoi(opts.at("keep-checkpoints"));
+      const bool latest_optimizer_only =
+        std::stoi(opts.at("latest-optimizer-only"));
+      const bool compress = std::stoi(opts.at("compress-checkpoints"));
+      const unsigned num_neg_samples = std::stoi(opts.at("sampled-softmax"));
+      const unsigned seed = opts.at("seed").empty()
+        ? std::random_device()() : std::stoul(opts.at("seed"));
+      const bool lazy_adam = std::stoi(opts.at("lazy-adam"));
+      const unsigned recompute_segment =
+        std::stoi(opts.at("recompute-segment"));
+#ifndef PRIMITIV_NMT_USE_CUDA
+      ::apply_cpu_options(opts);
+#endif
+
+      primitiv_nmt::proto::ModelConfig config;
+      config.set_rnn_cell(opts.at("cell"));
+      config.set_attention_window(std::stoi(opts.at("attention-window")));
+      config.set_tie_target_embedding(std::stoi(opts.at("tie-embedding")));
+      if (!opts.at("adaptive-softmax").empty()) {
+        for (const auto &s : ::split(opts.at("adaptive-softmax"), ',')) {
+          config.add_adaptive_softmax_cutoffs(std::stoi(s));
+        }
+      }
+      // Checked before making the model directory.
+      if (num_neg_samples > 0 && config.adaptive_softmax_cutoffs_size() > 0) {
+        throw std::runtime_error(
+            "Sampled softmax can not be used with adaptive softmax.");
+      }
+      if (lazy_adam && (hogwild || world_size > 1)) {
+        throw std::runtime_error(
+            "Lazy Adam can not be used with hogwild or multiple processes.");
+      }
 
-      ::make_directory(model_dir);
-      ::save_value(model_dir + "/batch_size", batch_size);
-      ::save_value(model_dir + "/best.epoch", 0);
-      ::save_value(model_dir + "/best.dev_avg_loss", 1e10f);
+      if (rank == 0) {
+        ::make_directory(model_dir);
+        ::save_value(model_dir + "/batch_size", batch_size);
+        ::save_value(model_dir + "/max_batch_tokens", max_tokens);
+        ::save_proto(model_dir + "/config", config);
+        ::save_value(model_dir + "/best.epoch", 0);
+        ::save_value(model_dir + "/best.dev_avg_loss", 1e10f);
+      }
 
       std::cout << "Loading vocabularies ... " << std::flush;
       const ::Vocabulary src_vocab(src_vocab_file);
@@ -61,43 +155,65 @@ int main(int argc, char *argv[]) {
       primitiv_nmt::proto::Corpus train_corpus, dev_corpus;
       ::load_proto(train_corpus_file, train_corpus);
       ::load_proto(dev_corpus_file, dev_corpus);
-      std::random_device rd;
-      ::RandomBatchSampler train_sampler(train_corpus, batch_size, rd());
-      ::MonotoneSampler dev_sampler(dev_corpus);
+      ::shard_corpus(train_corpus, rank, world_size);
+      ::RandomBatchSampler train_sampler(
+          train_corpus, batch_size, seed, max_tokens);
       std::cout << "done." << std::endl;
 
       std::cout << "Initializing devices ... " << std::flush;
 #ifdef PRIMITIV_NMT_USE_CUDA
       primitiv::devices::CUDA dev(gpu_id);
+      primitiv::devices::CUDA dec_dev(gpu_id);
 #else
       primitiv::devices::Eigen dev;
+      primitiv::devices::Eigen dec_dev;
 #endif
       primitiv::Device::set_default(dev);
       std::cout << "done." << std::endl;
 
       std::cout << "Initializing model ... " << std::flush;
-      ::EncoderDecoder<primitiv::Node> model;
+      ::EncoderDecoder<primitiv::Node> model(config);
       model.init(src_vocab.size(), trg_vocab.size(), embed_size, hidden_size);
       std::cout << "done." << std::endl;
 
       std::cout << "Initializing trainer ... " << std::flush;
-      primitiv::optimizers::Adam opt(learning_rate);
-      opt.set_weight_decay(1e-6);
-      opt.set_gradient_clipping(5);
-      opt.add(model);
+      std::unique_ptr<primitiv::optimizers::Adam> opt;
+      if (lazy_adam) {
+        opt.reset(new ::LazyAdam(learning_rate));
+      } else {
+        opt.reset(new primitiv::optimizers::Adam(learning_rate));
+      }
+      opt->set_weight_decay(1e-6);
+      opt->set_gradient_clipping(5);
+      opt->add(model);
+      std::cout << "done." << std::endl;
+
+      std::cout << "Connecting processes ... " << std::flush;
+      ::RingCommunicator comm(
+          rank, world_size, ::make_addresses(opts.at("hosts"), world_size));
       std::cout << "done." << std::endl;
 
       NMTTrainer trainer(
           model_dir, src_vocab, trg_vocab, model,
-          opt, train_sampler, dev_sampler, 0);
+          *opt, train_sampler, dev_corpus, 0,
+          world_size > 1 ? &comm : nullptr);
+      trainer.set_num_workers(num_workers, dev, hogwild);
+      trainer.set_decoder_device(dec_dev);
+      trainer.set_checkpoint_steps(checkpoint_steps);
+      trainer.set_checkpoint_policy(num_keeps, latest_optimizer_only, compress);
+      trainer.set_sampled_softmax(num_neg_samples, seed + 1);
+      trainer.set_recompute_segment(recompute_segment);
 
-      std::cout << "Saving initial model ... " << std::flush;
-      trainer.save(
-          1e10, 1e10, std::vector<std::string>(dev_corpus.samples_size()));
-      std::cout << "done." << std::endl;
+      if (rank == 0) {
+        std::cout << "Saving initial model ... " << std::flush;
+        trainer.save(1e10, 1e10, false, false);
+        trainer.wait_for_save();
+        std::cout << "done." << std::endl;
+      }
 
       std::cout << "Start training." << std::endl;
       for (unsigned i = 0; i < num_epochs; ++i) trainer.train();
+      trainer.wait_for_save();
       std::cout << "Finished." << std::endl;
   });
 
@@ -2,23 +2,68 @@
 
 #include <cstdio>
 #include <iostream>
+#include <memory>
 #include <string>
 
 #include <primitiv/primitiv.h>
 
+#include <primitiv_nmt/bpe.h>
+#include <primitiv_nmt/compressed_model.h>
+#include <primitiv_nmt/cpu_affinity.h>
 #include <primitiv_nmt/encoder_decoder.h>
 #include <primitiv_nmt/nmt_utils.h>
+#include <primitiv_nmt/shortlist.h>
+#include <primitiv_nmt/sparse.h>
+#include <primitiv_nmt/translation_cache.h>
 #include <primitiv_nmt/utils.h>
 #include <primitiv_nmt/vocabulary.h>
 
 int main(int argc, char *argv[]) {
-  ::check_args(argc, argv, {
+  const auto opts = ::check_args(argc, argv, {
       "(file/in) Source vocabulary file",
       "(file/in) Target vocabulary file",
       "(dir/in) Model directory",
       "(int) Epoch",
 #ifdef PRIMITIV_NMT_USE_CUDA
       "(int) GPU ID",
+#endif
+  }, {
+      {"config", "",
+        "(file/in) Config file of default option values, e.g., written by "
+        "autotune"},
+      {"src-bpe", "", "(file/in) BPE model file applied to input sentences"},
+      {"remove-bpe", "0", "(0/1) Restores words from subwords in outputs"},
+      {"shortlist", "", "(file/in) Shortlist file to restrict target words"},
+      {"shortlist-frequent", "1000",
+        "(int) Number of frequent target words added to the shortlist"},
+      {"attention", "0", "(0/1) Prints attention probabilities"},
+      {"src-tables", "0",
+        "(0/1) Precomputes RNN inputs of all source words (uses more memory)"},
+      {"trg-tables", "0",
+        "(0/1) Precomputes RNN inputs of all target words (uses more memory)"},
+#ifdef PRIMITIV_NMT_USE_CUDA
+      {"sparse-threshold", "2",
+#else
+      // Crossover of 4x4 blocks on Eigen. See bench_sparse.
+      {"sparse-threshold", "0.9",
+#endif
+        "(float) Uses sparse kernels for weight matrices with at least this "
+        "ratio of zero blocks (>1: disabled)"},
+      {"sparse-block", "4x4",
+        "(str) Block size <rows>x<cols> of sparse kernels"},
+      {"cache-size", "0",
+        "(int) Memory bound of the translation cache in MB (0: disabled)"},
+      {"cache-file", "",
+        "(file/in/out) Persistent translation cache, loaded at startup and "
+        "saved at exit"},
+#ifndef PRIMITIV_NMT_USE_CUDA
+      {"intra-threads", "0",
+        "(int) Number of threads used by each tensor operation "
+        "(0: OpenMP default)"},
+      {"cpus", "", "(str) Pins the process to CPUs, e.g., 0-7,16-23"},
+      {"numa-node", "-1",
+        "(int) Runs the process and allocates its memory on the NUMA node "
+        "(-1: disabled)"},
 #endif
   });
 
@@ -29,6 +74,8 @@ int main(int argc, char *argv[]) {
       const unsigned epoch = std::stoi(*++argv);
 #ifdef PRIMITIV_NMT_USE_CUDA
       const unsigned gpu_id = std::stoi(*++argv);
+#else
+      ::apply_cpu_options(opts);
 #endif
 
       const std::string subdir = ::get_model_dir(model_dir, epoch);
@@ -45,12 +92,49 @@ int main(int argc, char *argv[]) {
 #endif
       primitiv::Device::set_default(dev);
 
-      ::EncoderDecoder<primitiv::Tensor> model;
-      model.load(subdir + "/model");
+      ::EncoderDecoder<primitiv::Tensor> model(
+          ::load_model_config(model_dir));
+      ::load_checkpoint_model(model, subdir, false);
+      model.precompute_tables(
+          std::stoi(opts.at("src-tables")), std::stoi(opts.at("trg-tables")));
+      const float sparse_threshold = std::stof(opts.at("sparse-threshold"));
+      if (sparse_threshold <= 1) {
+        const auto block = ::parse_block_size(opts.at("sparse-block"));
+        model.make_sparse(sparse_threshold, block.first, block.second);
+      }
+
+      std::unique_ptr<::BPE> src_bpe;
+      if (!opts.at("src-bpe").empty()) {
+        src_bpe.reset(new ::BPE(opts.at("src-bpe")));
+      }
+      const bool remove_bpe = std::stoi(opts.at("remove-bpe"));
+      const bool with_atten = std::stoi(opts.at("attention"));
+      const unsigned limit = 64;
+      ::BPECache bpe_cache;
+
+      std::unique_ptr<::Shortlist> shortlist;
+      if (!opts.at("shortlist").empty()) {
+        shortlist.reset(new ::Shortlist(
+              opts.at("shortlist"), trg_vocab,
+              std::stoi(opts.at("shortlist-frequent"))));
+      }
+
+      std::unique_ptr<::TranslationCache> cache;
+      const std::string cache_file = opts.at("cache-file");
+      if (std::stoi(opts.at("cache-size")) > 0) {
+        cache.reset(new ::TranslationCache(
+              std::stoul(opts.at("cache-size")) << 20,
+              ::make_cache_fingerprint(
+                {src_vocab_file, trg_vocab_file, subdir}, limit, opts)));
+        if (!cache_file.empty() && ::path_exists(cache_file)) {
+          cache->load(cache_file);
+        }
+      }
 
       std::string line;
 
       while (std::getline(std::cin, line)) {
+        if (src_bpe) line = src_bpe->encode_line(line, bpe_cache);
         const std::vector<unsigned> src_ids = src_vocab.line_to_ids(
             "<bos> " + line + " <eos>");
         if (src_ids.size() < 3) {
@@ -64,11 +148,20 @@ int main(int argc, char *argv[]) {
           src_batch.emplace_back(std::vector<unsigned> {src_id});
         }
 
-        const ::Result ret = ::infer_sentence(
-            model, bos_id, eos_id, src_batch, 64);
-        const std::string hyp_str = ::make_hyp_str(ret, trg_vocab);
+        const ::Result *cached =
+          cache ? cache->find(src_ids, with_atten) : nullptr;
+        ::Result ret;
+        if (cached) {
+          ret = *cached;
+        } else {
+          if (shortlist) model.restrict_targets(shortlist->get(src_batch));
+          ret = ::infer_sentence(
+              model, bos_id, eos_id, src_batch, limit, with_atten);
+          if (cache) cache->insert(src_ids, with_atten, ret);
+        }
+        std::string hyp_str = ::make_hyp_str(ret, trg_vocab);
+        if (remove_bpe) hyp_str = ::remove_bpe(hyp_str);
 
-        /*
         for (unsigned i = 0; i < ret.atten_probs.size(); ++i) {
           std::cout << "a" << (i + 1) << "\t[";
           for (float ap : ret.atten_probs[i]) {
@@ -77,8 +170,15 @@ int main(int argc, char *argv[]) {
           }
           std::cout << " ]" << std::endl;
         }
-        */
-        std::cout /* << "h\t" */ << hyp_str << std::endl;
+        if (with_atten) std::cout << "h\t";
+        std::cout << hyp_str << std::endl;
+      }
+
+      if (cache) {
+        if (!cache_file.empty()) cache->save(cache_file);
+        std::cerr << "Cache: " << cache->num_hits() << '/'
+          << cache->num_lookups() << " hits (" << 100 * cache->hit_rate()
+          << "%), " << cache->num_entries() << " entries" << std::endl;
       }
   });
 
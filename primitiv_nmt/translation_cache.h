@@ -0,0 +1,207 @@
+#ifndef PRIMITIV_NMT_TRANSLATION_CACHE_H_
+#define PRIMITIV_NMT_TRANSLATION_CACHE_H_
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <list>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <primitiv_nmt/nmt_utils.h>
+#include <primitiv_nmt/primitiv_nmt.pb.h>
+#include <primitiv_nmt/utils.h>
+
+// Hashes bytes of a file by 64-bit FNV-1a.
+inline std::uint64_t hash_file(const std::string &path) {
+  std::ifstream ifs(path, std::ios::binary);
+  if (!ifs.is_open()) {
+    throw std::runtime_error(
+        "Failed to open file: " + path + ": " + std::strerror(errno));
+  }
+  std::uint64_t hash = 14695981039346656037ull;
+  std::vector<char> buf(1 << 16);
+  while (ifs.read(buf.data(), buf.size()) || ifs.gcount() > 0) {
+    const std::size_t n = ifs.gcount();
+    for (std::size_t i = 0; i < n; ++i) {
+      hash = (hash ^ static_cast<unsigned char>(buf[i])) * 1099511628211ull;
+    }
+  }
+  return hash;
+}
+
+// Makes a fingerprint of the settings which affect translation results:
+// `files` of vocabularies and model directories, the length limit and
+// options of decoding. Contents of the files, the parameter files in the
+// model directories and the shortlist are identified by their hashes, so
+// that files overwritten at the same paths invalidate the cache.
+inline std::string make_cache_fingerprint(
+    const std::vector<std::string> &files, unsigned limit,
+    const std::map<std::string, std::string> &opts) {
+  std::string fingerprint = "limit=" + std::to_string(limit);
+  const auto add_file = [&](const std::string &path) {
+    fingerprint += ";file=" + path + ":" + std::to_string(::hash_file(path));
+  };
+  for (const std::string &file : files) {
+    bool is_model_dir = false;
+    for (const char *name : {"/model", "/model.bin"}) {
+      if (::path_exists(file + name)) {
+        add_file(file + name);
+        is_model_dir = true;
+      }
+    }
+    if (!is_model_dir) add_file(file);
+  }
+  if (!opts.at("shortlist").empty()) add_file(opts.at("shortlist"));
+  for (const char *name : {
+      "shortlist", "shortlist-frequent", "sparse-threshold", "sparse-block"}) {
+    fingerprint += std::string(";") + name + "=" + opts.at(name);
+  }
+  return fingerprint;
+}
+
+// LRU cache of translation results keyed by source word IDs and whether
+// attention probabilities are required.
+// The memory usage is bounded by the approximate size of stored entries.
+class TranslationCache {
+  struct Entry {
+    std::vector<unsigned> source_ids;
+    bool with_atten;
+    ::Result result;
+    std::size_t size;
+  };
+
+  std::size_t max_size_;
+  std::string fingerprint_;
+  std::size_t size_;
+  std::list<Entry> entries_;  // From the most recently used one.
+  std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+  unsigned long num_hits_;
+  unsigned long num_lookups_;
+
+  static std::string make_key(
+      const std::vector<unsigned> &ids, bool with_atten) {
+    return std::string(
+        reinterpret_cast<const char *>(ids.data()),
+        ids.size() * sizeof(unsigned)) + (with_atten ? 'a' : 'n');
+  }
+
+  // Approximate memory usage of the entry including the index.
+  static std::size_t get_size(
+      const std::vector<unsigned> &source_ids, const ::Result &result) {
+    std::size_t size = 2 * source_ids.size() + result.word_ids.size();
+    for (const auto &probs : result.atten_probs) size += probs.size();
+    return 4 * size + 128;
+  }
+
+  void evict() {
+    while (size_ > max_size_ && !entries_.empty()) {
+      const Entry &entry = entries_.back();
+      size_ -= entry.size;
+      index_.erase(make_key(entry.source_ids, entry.with_atten));
+      entries_.pop_back();
+    }
+  }
+
+public:
+  // New cache which holds entries up to about `max_size` bytes.
+  // `fingerprint` is made by make_cache_fingerprint().
+  TranslationCache(std::size_t max_size, const std::string &fingerprint)
+    : max_size_(max_size)
+    , fingerprint_(fingerprint)
+    , size_(0)
+    , num_hits_(0)
+    , num_lookups_(0) {}
+
+  // Retrieves the result of the source sentence. Returns nullptr if it is
+  // not cached.
+  const ::Result *find(
+      const std::vector<unsigned> &source_ids, bool with_atten) {
+    ++num_lookups_;
+    const auto it = index_.find(make_key(source_ids, with_atten));
+    if (it == index_.end()) return nullptr;
+    ++num_hits_;
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return &it->second->result;
+  }
+
+  // Stores the result of the source sentence as the most recently used one.
+  void insert(
+      const std::vector<unsigned> &source_ids, bool with_atten,
+      const ::Result &result) {
+    const std::string key = make_key(source_ids, with_atten);
+    const auto it = index_.find(key);
+    if (it != index_.end()) {
+      size_ -= it->second->size;
+      entries_.erase(it->second);
+      index_.erase(it);
+    }
+    const std::size_t size = get_size(source_ids, result);
+    if (size > max_size_) return;
+    entries_.push_front(Entry { source_ids, with_atten, result, size });
+    index_.emplace(key, entries_.begin());
+    size_ += size;
+    evict();
+  }
+
+  // Loads entries saved by save(). Entries exceeding the size are dropped
+  // from the least recently used ones. The file is ignored if it was made
+  // with a different fingerprint, and is overwritten by save().
+  void load(const std::string &path) {
+    primitiv_nmt::proto::TranslationCache cache;
+    ::load_proto(path, cache);
+    if (cache.fingerprint() != fingerprint_) {
+      std::cerr << "WARNING: translation cache made with different models or "
+                << "options is ignored: " << path << std::endl;
+      return;
+    }
+    for (const auto &entry : cache.entries()) {
+      const std::vector<unsigned> source_ids(
+          entry.source_ids().begin(), entry.source_ids().end());
+      ::Result result {
+        {entry.target_ids().begin(), entry.target_ids().end()}, {} };
+      const unsigned len = source_ids.size();
+      const unsigned num_probs = entry.atten_probs_size();
+      for (unsigned i = 0; len > 0 && i + len <= num_probs; i += len) {
+        result.atten_probs.emplace_back(
+            entry.atten_probs().begin() + i,
+            entry.atten_probs().begin() + i + len);
+      }
+      insert(source_ids, entry.with_atten(), result);
+    }
+  }
+
+  // Saves all entries.
+  void save(const std::string &path) const {
+    primitiv_nmt::proto::TranslationCache cache;
+    cache.set_fingerprint(fingerprint_);
+    for (auto it = entries_.rbegin(); it != entries_.rend(); ++it) {
+      auto *entry = cache.add_entries();
+      for (unsigned id : it->source_ids) entry->add_source_ids(id);
+      entry->set_with_atten(it->with_atten);
+      for (unsigned id : it->result.word_ids) entry->add_target_ids(id);
+      for (const auto &probs : it->result.atten_probs) {
+        for (float p : probs) entry->add_atten_probs(p);
+      }
+    }
+    ::save_proto(path, cache);
+  }
+
+  // Retrieves statistics.
+  unsigned long num_hits() const { return num_hits_; }
+  unsigned long num_lookups() const { return num_lookups_; }
+  float hit_rate() const {
+    return num_lookups_ > 0 ? static_cast<float>(num_hits_) / num_lookups_ : 0;
+  }
+  std::size_t num_entries() const { return entries_.size(); }
+  std::size_t size() const { return size_; }
+};
+
+#endif  // PRIMITIV_NMT_TRANSLATION_CACHE_H_
@@ -8,21 +8,142 @@
 #include <cstring>
 #include <fstream>
 #include <functional>
+#include <iostream>
+#include <map>
 #include <stdexcept>
 #include <string>
 #include <vector>
 
+#include <dirent.h>
 #include <sys/stat.h>
+#include <unistd.h>
+
+// Optional argument given as "--name value" or "--name=value".
+struct OptionSpec {
+  std::string name;
+  std::string default_value;
+  std::string desc;
+};
+
+inline void print_usage(
+    char *argv[], const std::vector<std::string> &desc,
+    const std::vector<::OptionSpec> &opts) {
+  std::cerr << "Usage: " << argv[0] << std::endl;
+  for (unsigned i = 0; i < desc.size(); ++i) {
+    std::cerr << "    [" << (i + 1) << "] " << desc[i] << std::endl;
+  }
+  if (!opts.empty()) {
+    std::cerr << "Options:" << std::endl;
+    for (const ::OptionSpec &opt : opts) {
+      std::cerr << "    --" << opt.name << ' ' << opt.desc
+                << " (default: " << opt.default_value << ')' << std::endl;
+    }
+  }
+}
 
 inline void check_args(
     int argc, char *argv[], const std::vector<std::string> &desc) {
   if (static_cast<unsigned>(argc) != desc.size() + 1) {
-    std::cerr << "Usage: " << argv[0] << std::endl;
-    for (unsigned i = 0; i < desc.size(); ++i) {
-      std::cerr << "    [" << (i + 1) << "] " << desc[i] << std::endl;
+    ::print_usage(argv, desc, {});
+    std::exit(1);
+  }
+}
+
+// Reads option values from the configuration file, which has one
+// "<name> <value>" pair per line. Empty lines and text after '#' are ignored.
+// Options which are given in the command line or unknown to the program are
+// not overwritten, so that one file can be shared by several programs.
+// "<program>:<name> <value>" is read only by `program`, and takes precedence
+// over "<name> <value>".
+inline bool read_config_file(
+    const std::string &path, const std::string &program,
+    const std::vector<std::string> &given,
+    std::map<std::string, std::string> &values) {
+  std::ifstream ifs(path);
+  if (!ifs.is_open()) {
+    std::cerr << "Could not open config file: " << path << std::endl;
+    return false;
+  }
+  std::map<std::string, std::string> program_values;
+  std::string line;
+  while (std::getline(ifs, line)) {
+    line = line.substr(0, line.find('#'));
+    const std::size_t begin = line.find_first_not_of(" \t");
+    if (begin == std::string::npos) continue;
+    const std::size_t end = line.find_first_of(" \t", begin);
+    std::string name = line.substr(begin, end - begin);
+    const std::size_t colon = name.find(':');
+    if (colon != std::string::npos) {
+      if (name.substr(0, colon) != program) continue;
+      name = name.substr(colon + 1);
+    }
+    std::string value;
+    if (end != std::string::npos) {
+      const std::size_t vb = line.find_first_not_of(" \t", end);
+      if (vb != std::string::npos) {
+        value = line.substr(vb, line.find_last_not_of(" \t") + 1 - vb);
+      }
     }
+    if (name == "config" || values.find(name) == values.end()) continue;
+    bool is_given = false;
+    for (const std::string &g : given) is_given |= g == name;
+    if (is_given) continue;
+    if (colon != std::string::npos) program_values[name] = value;
+    else values[name] = value;
+  }
+  for (const auto &kv : program_values) values[kv.first] = kv.second;
+  return true;
+}
+
+// Same as above, but also accepts options.
+// Positional arguments are moved to the front of argv so that they can be
+// retrieved in order, and the option values are returned.
+// If the program has the "config" option, values in the given configuration
+// file are used as defaults of other options.
+inline std::map<std::string, std::string> check_args(
+    int argc, char *argv[], const std::vector<std::string> &desc,
+    const std::vector<::OptionSpec> &opts) {
+  std::map<std::string, std::string> values;
+  for (const ::OptionSpec &opt : opts) {
+    values[opt.name] = opt.default_value;
+  }
+  std::vector<std::string> given;
+  unsigned num_args = 0;
+  bool valid = true;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg.compare(0, 2, "--") != 0) {
+      argv[++num_args] = argv[i];
+      continue;
+    }
+    const std::size_t eq = arg.find('=');
+    const std::string name = arg.substr(
+        2, eq == std::string::npos ? std::string::npos : eq - 2);
+    if (values.find(name) == values.end()) {
+      std::cerr << "Unknown option: " << arg << std::endl;
+      valid = false;
+    } else if (eq != std::string::npos) {
+      values[name] = arg.substr(eq + 1);
+      given.emplace_back(name);
+    } else if (i + 1 < argc) {
+      values[name] = argv[++i];
+      given.emplace_back(name);
+    } else {
+      std::cerr << "Missing value: " << arg << std::endl;
+      valid = false;
+    }
+  }
+  const auto config = values.find("config");
+  if (valid && config != values.end() && !config->second.empty()) {
+    const std::string program = argv[0];
+    valid = ::read_config_file(
+        config->second, program.substr(program.rfind('/') + 1), given, values);
+  }
+  if (!valid || num_args != desc.size()) {
+    ::print_usage(argv, desc, opts);
     std::exit(1);
   }
+  return values;
 }
 
 inline void global_try_block(std::function<void()> subroutine) {
@@ -54,6 +175,62 @@ inline void make_directory(const std::string &path) {
   }
 }
 
+inline bool path_exists(const std::string &path) {
+  struct ::stat st;
+  return ::stat(path.c_str(), &st) == 0;
+}
+
+// Retrieves names of all entries in a directory.
+inline std::vector<std::string> list_directory(const std::string &path) {
+  ::DIR *dir = ::opendir(path.c_str());
+  if (!dir) {
+    throw std::runtime_error(
+        "Failed to open directory: " + path + ": " + std::strerror(errno));
+  }
+  std::vector<std::string> names;
+  while (const ::dirent *ent = ::readdir(dir)) {
+    const std::string name = ent->d_name;
+    if (name != "." && name != "..") names.emplace_back(name);
+  }
+  ::closedir(dir);
+  return names;
+}
+
+// Removes a directory and all its contents.
+inline void remove_directory(const std::string &path) {
+  ::DIR *dir = ::opendir(path.c_str());
+  if (!dir) {
+    throw std::runtime_error(
+        "Failed to open directory: " + path + ": " + std::strerror(errno));
+  }
+  while (const ::dirent *ent = ::readdir(dir)) {
+    const std::string name = ent->d_name;
+    if (name == "." || name == "..") continue;
+    const std::string child = path + '/' + name;
+    struct ::stat st;
+    if (::lstat(child.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+      ::remove_directory(child);
+    } else if (::unlink(child.c_str()) != 0) {
+      ::closedir(dir);
+      throw std::runtime_error(
+          "Failed to remove file: " + child + ": " + std::strerror(errno));
+    }
+  }
+  ::closedir(dir);
+  if (::rmdir(path.c_str()) != 0) {
+    throw std::runtime_error(
+        "Failed to remove directory: " + path + ": " + std::strerror(errno));
+  }
+}
+
+inline void rename_path(const std::string &from, const std::string &to) {
+  if (std::rename(from.c_str(), to.c_str()) != 0) {
+    throw std::runtime_error(
+        "Failed to rename " + from + " to " + to + ": "
+        + std::strerror(errno));
+  }
+}
+
 template <typename T>
 inline void save_value(const std::string &path, T value) {
   std::ofstream ofs;
@@ -86,6 +263,17 @@ inline void save_strings(
   for (const std::string &str : strs) ofs << str << std::endl;
 }
 
+// Reads at most `max_lines` lines. Returns false if no line was read.
+inline bool read_lines(
+    std::istream &is, unsigned max_lines, std::vector<std::string> &lines) {
+  lines.clear();
+  std::string line;
+  while (lines.size() < max_lines && std::getline(is, line)) {
+    lines.emplace_back(std::move(line));
+  }
+  return !lines.empty();
+}
+
 template <class ProtoT>
 inline void save_proto(const std::string &path, const ProtoT &proto) {
   std::ofstream ofs;
@@ -139,23 +327,19 @@ inline std::vector<std::string> split(
   return ret;
 }
 
-inline unsigned argmax(const std::vector<float> &scores) {
-  if (scores.empty()) throw std::runtime_error("No scores to calculate argmax.");
-  unsigned max_id = 0;
-  float max_score = scores[0];
-  for (unsigned i = 1; i < scores.size(); ++i) {
-    if (scores[i] > max_score) {
-      max_id = i;
-      max_score = scores[i];
-    }
-  }
-  return max_id;
-}
-
 inline std::string get_model_dir(const std::string &prefix, unsigned epoch) {
   char buf[8];
   std::sprintf(buf, "%04u", epoch);
   return prefix + '/' + buf;
 }
 
+// Directory of the checkpoint saved after `step` updates in the next epoch of
+// `epoch`.
+inline std::string get_step_dir(
+    const std::string &prefix, unsigned epoch, unsigned step) {
+  char buf[24];
+  std::sprintf(buf, "%04u.%08u", epoch, step);
+  return prefix + '/' + buf;
+}
+
 #endif  // PRIMITIV_NMT_UTILS_H_